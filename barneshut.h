@@ -0,0 +1,537 @@
+#ifndef BARNESHUT_H
+#define BARNESHUT_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include "body.h"
+#include "directsum.h"
+#include "threadpool.h"
+
+// One cell of the octree, exactly one cache line. Nodes live in a single
+// cache-aligned pool that is reused from build to build, and point at their
+// children by 32-bit index; the 8 children of a node are always stored next
+// to each other. Every node owns the slice order[begin, begin + count) of the
+// body index list, so a leaf's bodies can be read without any extra storage.
+struct alignas(64) OctreeNode {
+    glm::vec3 center;   // centre of the cell: geometric, or of its bodies' bounds after a refit
+    float halfSize;
+    glm::vec3 com;      // centre of mass of everything below this node
+    float mass;
+    int firstChild;     // -1 for leaves
+    int begin;
+    int count;
+    // traceless quadrupole about com, sum m (3 d d^T - |d|^2 I): xx, xy, xz,
+    // yy, yz (zz = -xx - yy); only filled in when the tree wants quadrupoles
+    float quad[5] = {};
+};
+static_assert(sizeof(OctreeNode) == 64, "octree nodes should fill one cache line");
+
+// cost of keeping a tree up to date, for the last update() and in total
+struct TreeStats {
+    double lastMs = 0.0;
+    bool lastRebuilt = false;
+    int refitsSinceBuild = 0;
+    float inflation = 1.0f;     // cell growth since the last rebuild
+    double totalMs = 0.0;
+    long long builds = 0;
+    long long refits = 0;
+    size_t bytes = 0;           // memory held by the tree
+};
+
+// With refit on, update() keeps the topology from the last full build while
+// it can and only recomputes each node's moments and bounds, bottom-up one
+// depth at a time across the pool. A refitted cell is the bounding cube of
+// whatever bodies it holds now, so the walk stays correct however far they
+// have moved; it just gets slower as cells grow and overlap. How much the
+// cells have grown since the last build measures that, and once it passes
+// rebuildInflation, or after maxRefits refits, the tree is rebuilt.
+class Octree
+{
+public:
+    AlignedVector<OctreeNode> nodes;
+    std::vector<int> order;
+    int leafSize = 8;
+    int maxDepth = 32;
+    bool refit = false;
+    bool quadrupole = false;    // carry quadrupole moments and use them in the walk
+    float rebuildInflation = 1.3f;
+    int maxRefits = 64;
+    TreeStats stats;
+
+    // build, or refit when that is allowed and still good enough
+    void update(const BodySoA& bodies, ThreadPool& pool)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point start = Clock::now();
+        bool rebuilt = true;
+        // a tree from a plain build() has no baseline to refit against
+        if (!refit || nodes.empty() || builtHalf.size() != nodes.size() || order.size() != bodies.size()
+            || quadrupole != builtQuadrupole || stats.refitsSinceBuild >= maxRefits) {
+            rebuild(bodies, pool);
+        }
+        else {
+            refitNodes(bodies, pool);
+            stats.inflation = (float)inflation();
+            if (stats.inflation > rebuildInflation) {
+                rebuild(bodies, pool);
+            }
+            else {
+                rebuilt = false;
+                stats.refitsSinceBuild++;
+                stats.refits++;
+            }
+        }
+        stats.lastRebuilt = rebuilt;
+        stats.bytes = memoryBytes();
+        stats.lastMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        stats.totalMs += stats.lastMs;
+    }
+
+    // the bodies were reordered so slot i holds what was in slot perm[i]; the
+    // tree follows them rather than starting over
+    void reorder(const std::vector<int>& perm)
+    {
+        if (order.size() != perm.size())
+            return;
+        scratch.resize(perm.size());
+        for (size_t i = 0; i < perm.size(); i++)
+            scratch[perm[i]] = (int)i;
+        for (int& idx : order)
+            idx = scratch[idx];
+    }
+
+    void build(const BodySoA& bodies)
+    {
+        stats.builds++;
+        stats.refitsSinceBuild = 0;
+        builtQuadrupole = quadrupole;
+        stats.inflation = 1.0f;
+        levels.clear();
+        nodes.clear();
+        order.resize(bodies.size());
+        scratch.resize(bodies.size());
+        for (size_t i = 0; i < bodies.size(); i++)
+            order[i] = (int)i;
+        if (bodies.empty())
+            return;
+
+        glm::vec3 lo = bodies.pos(0), hi = bodies.pos(0);
+        for (size_t i = 1; i < bodies.size(); i++) {
+            lo = glm::min(lo, bodies.pos(i));
+            hi = glm::max(hi, bodies.pos(i));
+        }
+        glm::vec3 extent = hi - lo;
+        float half = 0.5f * std::max(extent.x, std::max(extent.y, extent.z));
+        // pad a little so bodies on the far faces still land inside the root
+        half = half * 1.001f + 1e-6f;
+
+        // a uniform cloud needs about 3 N / leafSize nodes; clear() above
+        // kept the pool from last time, so this only ever grows it
+        nodes.reserve(3 * bodies.size() / leafSize + 64);
+        nodes.push_back({ 0.5f * (lo + hi), half, glm::vec3(0.0f), 0.0f, -1, 0, (int)bodies.size() });
+        buildNode(bodies, 0, 0);
+    }
+
+    // acceleration of body i, opening any cell whose size/distance ratio is at
+    // least theta; accepted cells add their quadrupole term if the tree has them
+    glm::vec3 accelOn(const BodySoA& bodies, int i, float G, float theta) const
+    {
+        return accelAt(bodies, bodies.pos(i), i, G, theta);
+    }
+
+    // pull of the tree's bodies on a point p, leaving out body self (-1 for a
+    // point that isn't one of them)
+    glm::vec3 accelAt(const BodySoA& bodies, const glm::vec3& p, int self, float G, float theta) const
+    {
+        glm::vec3 acc(0.0f);
+        if (nodes.empty())
+            return acc;
+
+        const float theta2 = theta * theta;
+
+        int stack[8 * 64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const OctreeNode& node = nodes[stack[--top]];
+            if (node.count == 0)
+                continue;
+
+            if (node.firstChild < 0) {
+                for (int k = node.begin; k < node.begin + node.count; k++) {
+                    int j = order[k];
+                    if (j == self) continue;
+                    acc += pairAccel(p, bodies.pos(j), bodies.mass[j], G);
+                }
+                continue;
+            }
+
+            glm::vec3 dir = node.com - p;
+            float dist2 = glm::dot(dir, dir);
+            float size = 2.0f * node.halfSize;
+            if (size * size < theta2 * dist2 && !contains(node, p)) {
+                acc += cellAccel(p, node, G);
+            }
+            else {
+                // last child pushed first, so the walk visits them in storage order
+                for (int c = 7; c >= 0; c--)
+                    stack[top++] = node.firstChild + c;
+            }
+        }
+        return acc;
+    }
+
+    // pull of an accepted cell: monopole, plus quadrupole if the tree has them
+    glm::vec3 cellAccel(const glm::vec3& p, const OctreeNode& node, float G) const
+    {
+        return builtQuadrupole ? quadAccel(p, node, G) : pairAccel(p, node.com, node.mass, G);
+    }
+    bool hasQuadrupoles() const { return builtQuadrupole; }
+
+    // everything the tree holds on to, scratch included
+    size_t memoryBytes() const
+    {
+        size_t levelBytes = 0;
+        for (const std::vector<int>& level : levels)
+            levelBytes += level.capacity() * sizeof(int);
+        return nodes.capacity() * sizeof(OctreeNode) + (order.capacity() + scratch.capacity()) * sizeof(int)
+            + levelBytes + (boxLo.capacity() + boxHi.capacity()) * sizeof(glm::vec3) + builtHalf.capacity() * sizeof(float);
+    }
+
+private:
+    std::vector<int> scratch;
+    std::vector<std::vector<int>> levels;   // node indices by depth, for refits
+    std::vector<glm::vec3> boxLo, boxHi;    // bodies' bounds per node, for refits
+    std::vector<float> builtHalf;           // cell sizes right after the last build
+    bool builtQuadrupole = false;
+
+    // in refit mode a fresh tree is refitted straight away, so its cells are
+    // bounding cubes like every later refit's and the size baseline compares
+    // like with like
+    void rebuild(const BodySoA& bodies, ThreadPool& pool)
+    {
+        build(bodies);
+        if (refit && !nodes.empty()) {
+            refitNodes(bodies, pool);
+            builtHalf.resize(nodes.size());
+            for (size_t n = 0; n < nodes.size(); n++)
+                builtHalf[n] = nodes[n].halfSize;
+        }
+    }
+
+    // cell sizes weighted by body count, now against at the last build: a
+    // cell that an escaping body has stretched counts once for every body in
+    // it, since every walk that opens it pays for them
+    double inflation() const
+    {
+        double now = 0.0, then = 0.0;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            now += (double)nodes[n].count * nodes[n].halfSize;
+            then += (double)nodes[n].count * builtHalf[n];
+        }
+        return then > 0.0 ? now / then : 1.0;
+    }
+
+    void collectLevels()
+    {
+        levels.assign(1, std::vector<int>(1, 0));
+        for (size_t d = 0; d < levels.size(); d++) {
+            std::vector<int> next;
+            for (int n : levels[d]) {
+                if (nodes[n].firstChild < 0)
+                    continue;
+                for (int c = 0; c < 8; c++) {
+                    if (nodes[nodes[n].firstChild + c].count > 0)
+                        next.push_back(nodes[n].firstChild + c);
+                }
+            }
+            if (!next.empty())
+                levels.push_back(std::move(next));
+        }
+    }
+
+    // moments and bounds again for the same topology, deepest level first so
+    // every node's children are done before it is
+    void refitNodes(const BodySoA& bodies, ThreadPool& pool)
+    {
+        if (levels.empty())
+            collectLevels();
+        boxLo.resize(nodes.size());
+        boxHi.resize(nodes.size());
+        for (size_t d = levels.size(); d-- > 0;) {
+            const std::vector<int>& level = levels[d];
+            pool.parallelFor(level.size(), 256, [&](size_t b, size_t e, int) {
+                for (size_t k = b; k < e; k++)
+                    refitNode(bodies, level[k]);
+            });
+        }
+    }
+
+    void refitNode(const BodySoA& bodies, int n)
+    {
+        OctreeNode& node = nodes[n];
+        glm::vec3 lo(1e30f), hi(-1e30f), com(0.0f);
+        float mass = 0.0f;
+        if (node.firstChild < 0) {
+            for (int k = node.begin; k < node.begin + node.count; k++) {
+                const int j = order[k];
+                const glm::vec3 p = bodies.pos(j);
+                lo = glm::min(lo, p);
+                hi = glm::max(hi, p);
+                com += bodies.mass[j] * p;
+                mass += bodies.mass[j];
+            }
+        }
+        else {
+            for (int c = node.firstChild; c < node.firstChild + 8; c++) {
+                if (nodes[c].count == 0)
+                    continue;
+                lo = glm::min(lo, boxLo[c]);
+                hi = glm::max(hi, boxHi[c]);
+                com += nodes[c].mass * nodes[c].com;
+                mass += nodes[c].mass;
+            }
+        }
+        boxLo[n] = lo;
+        boxHi[n] = hi;
+        const glm::vec3 half = 0.5f * (hi - lo);
+        node.center = 0.5f * (lo + hi);
+        node.halfSize = std::max(half.x, std::max(half.y, half.z));
+        node.mass = mass;
+        node.com = mass > 0.0f ? com / mass : node.center;
+        if (builtQuadrupole)
+            computeQuadrupole(bodies, n);
+    }
+
+    // about the node's com, which has to be final: leaves sum their bodies,
+    // inner nodes shift their children's tensors over (parallel axis theorem)
+    void computeQuadrupole(const BodySoA& bodies, int n)
+    {
+        OctreeNode& node = nodes[n];
+        float q[5] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        auto add = [&q](const glm::vec3& d, float m) {
+            const float d2 = glm::dot(d, d);
+            q[0] += m * (3.0f * d.x * d.x - d2);
+            q[1] += m * 3.0f * d.x * d.y;
+            q[2] += m * 3.0f * d.x * d.z;
+            q[3] += m * (3.0f * d.y * d.y - d2);
+            q[4] += m * 3.0f * d.y * d.z;
+        };
+        if (node.firstChild < 0) {
+            for (int k = node.begin; k < node.begin + node.count; k++) {
+                const int j = order[k];
+                add(bodies.pos(j) - node.com, bodies.mass[j]);
+            }
+        }
+        else {
+            for (int c = node.firstChild; c < node.firstChild + 8; c++) {
+                if (nodes[c].count == 0)
+                    continue;
+                for (int t = 0; t < 5; t++)
+                    q[t] += nodes[c].quad[t];
+                add(nodes[c].com - node.com, nodes[c].mass);
+            }
+        }
+        std::copy(q, q + 5, node.quad);
+    }
+
+    // monopole plus quadrupole pull of a node, sharing one square root:
+    // a = G (-M r / r^3 + Q r / r^5 - 5/2 (r.Q r) r / r^7), r from the node's
+    // com to p, softened the same way as pairAccel
+    static glm::vec3 quadAccel(const glm::vec3& p, const OctreeNode& node, float G)
+    {
+        const glm::vec3 r = p - node.com;
+        const float* q = node.quad;
+        const float qzz = -q[0] - q[3];
+        const glm::vec3 qr(q[0] * r.x + q[1] * r.y + q[2] * r.z,
+                           q[1] * r.x + q[3] * r.y + q[4] * r.z,
+                           q[2] * r.x + q[4] * r.y + qzz * r.z);
+        const float r2 = glm::dot(r, r) + SOFTENING;
+        const float inv2 = 1.0f / r2;
+        const float inv3 = inv2 / std::sqrt(r2);
+        const float inv5 = inv3 * inv2;
+        return G * ((inv5 * qr) - (node.mass * inv3 + 2.5f * glm::dot(r, qr) * inv5 * inv2) * r);
+    }
+
+    static glm::vec3 pairAccel(const glm::vec3& p, const glm::vec3& q, float mj, float G)
+    {
+        glm::vec3 dir = q - p;
+        float r2 = glm::dot(dir, dir) + SOFTENING;
+        return (G * mj / (r2 * std::sqrt(r2))) * dir;
+    }
+
+    static bool contains(const OctreeNode& node, const glm::vec3& p)
+    {
+        glm::vec3 d = glm::abs(p - node.center);
+        return d.x <= node.halfSize && d.y <= node.halfSize && d.z <= node.halfSize;
+    }
+
+    static int octant(const glm::vec3& p, const glm::vec3& c)
+    {
+        return (p.x >= c.x ? 1 : 0) | (p.y >= c.y ? 2 : 0) | (p.z >= c.z ? 4 : 0);
+    }
+
+    void buildNode(const BodySoA& bodies, int n, int depth)
+    {
+        const int begin = nodes[n].begin;
+        const int count = nodes[n].count;
+
+        if (count <= leafSize || depth >= maxDepth) {
+            glm::vec3 com(0.0f);
+            float mass = 0.0f;
+            for (int k = begin; k < begin + count; k++) {
+                int j = order[k];
+                com += bodies.mass[j] * bodies.pos(j);
+                mass += bodies.mass[j];
+            }
+            nodes[n].mass = mass;
+            nodes[n].com = mass > 0.0f ? com / mass : nodes[n].center;
+            if (builtQuadrupole)
+                computeQuadrupole(bodies, n);
+            return;
+        }
+
+        // counting sort of this node's slice into its 8 octants
+        const glm::vec3 center = nodes[n].center;
+        int counts[8] = { 0 };
+        for (int k = begin; k < begin + count; k++)
+            counts[octant(bodies.pos(order[k]), center)]++;
+        int offsets[8];
+        offsets[0] = begin;
+        for (int c = 1; c < 8; c++)
+            offsets[c] = offsets[c - 1] + counts[c - 1];
+        int cursor[8];
+        std::copy(offsets, offsets + 8, cursor);
+        for (int k = begin; k < begin + count; k++) {
+            int idx = order[k];
+            scratch[cursor[octant(bodies.pos(idx), center)]++] = idx;
+        }
+        std::copy(scratch.begin() + begin, scratch.begin() + begin + count, order.begin() + begin);
+
+        const int first = (int)nodes.size();
+        const float childHalf = 0.5f * nodes[n].halfSize;
+        for (int c = 0; c < 8; c++) {
+            glm::vec3 childCenter = center + childHalf * glm::vec3(
+                (c & 1) ? 1.0f : -1.0f,
+                (c & 2) ? 1.0f : -1.0f,
+                (c & 4) ? 1.0f : -1.0f);
+            nodes.push_back({ childCenter, childHalf, glm::vec3(0.0f), 0.0f, -1, offsets[c], counts[c] });
+        }
+        nodes[n].firstChild = first;
+
+        glm::vec3 com(0.0f);
+        float mass = 0.0f;
+        for (int c = 0; c < 8; c++) {
+            if (counts[c] == 0) continue;
+            buildNode(bodies, first + c, depth + 1);
+            com += nodes[first + c].mass * nodes[first + c].com;
+            mass += nodes[first + c].mass;
+        }
+        nodes[n].mass = mass;
+        nodes[n].com = mass > 0.0f ? com / mass : center;
+        if (builtQuadrupole)
+            computeQuadrupole(bodies, n);
+    }
+};
+
+// Walks are independent per body, so they are spread over the pool. Bodies are
+// visited in tree order: neighbouring walks open mostly the same cells.
+inline void computeAccelBarnesHut(Octree& tree, BodySoA& bodies, float G, float theta, ThreadPool& pool)
+{
+    tree.update(bodies, pool);
+    pool.parallelFor(bodies.size(), 256, [&](size_t b, size_t e, int) {
+        for (size_t k = b; k < e; k++) {
+            int i = tree.order[k];
+            glm::vec3 a = tree.accelOn(bodies, i, G, theta);
+            bodies.ax[i] = a.x;
+            bodies.ay[i] = a.y;
+            bodies.az[i] = a.z;
+        }
+    });
+}
+
+// tree walk for the listed bodies only (the tree still holds everyone)
+inline void computeAccelBarnesHut(Octree& tree, BodySoA& bodies, float G, float theta, ThreadPool& pool, const std::vector<int>& active)
+{
+    tree.update(bodies, pool);
+    pool.parallelFor(active.size(), 256, [&](size_t b, size_t e, int) {
+        for (size_t k = b; k < e; k++) {
+            int i = active[k];
+            glm::vec3 a = tree.accelOn(bodies, i, G, theta);
+            bodies.ax[i] = a.x;
+            bodies.ay[i] = a.y;
+            bodies.az[i] = a.z;
+        }
+    });
+}
+
+struct ForceError {
+    float mean = 0.0f;
+    float rms = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+    int samples = 0;
+};
+
+// Relative force error of any approximate solver against the direct sum,
+// |a_approx - a_direct| / |a_direct|, with approx(i) giving body i's
+// acceleration. For big N only a random subset of bodies is checked so this
+// stays O(samples * N).
+template <typename Approx>
+ForceError measureForceErrorOf(const BodySoA& bodies, float G, Approx approx, int maxSamples = 1000)
+{
+    ForceError err;
+    if (bodies.size() < 2)
+        return err;
+
+    std::vector<int> sample;
+    if ((int)bodies.size() <= maxSamples) {
+        for (size_t i = 0; i < bodies.size(); i++)
+            sample.push_back((int)i);
+    }
+    else {
+        std::mt19937 rng(12345);
+        std::uniform_int_distribution<int> pick(0, (int)bodies.size() - 1);
+        for (int s = 0; s < maxSamples; s++)
+            sample.push_back(pick(rng));
+    }
+
+    std::vector<float> rel;
+    rel.reserve(sample.size());
+    double sum = 0.0, sum2 = 0.0;
+    for (int i : sample) {
+        glm::vec3 exact = directAccelOn(bodies, i, G);
+        glm::vec3 estimate = approx(i);
+        float mag = glm::length(exact);
+        if (mag <= 0.0f) continue;
+        float e = glm::length(estimate - exact) / mag;
+        rel.push_back(e);
+        sum += e;
+        sum2 += (double)e * e;
+    }
+    if (rel.empty())
+        return err;
+
+    std::sort(rel.begin(), rel.end());
+    err.samples = (int)rel.size();
+    err.mean = (float)(sum / rel.size());
+    err.rms = (float)std::sqrt(sum2 / rel.size());
+    err.p99 = rel[std::min(rel.size() - 1, (size_t)(0.99 * rel.size()))];
+    err.max = rel.back();
+    return err;
+}
+
+// the same check for the Barnes-Hut walk
+inline ForceError measureForceError(const BodySoA& bodies, float G, float theta, bool quadrupole = false, int maxSamples = 1000)
+{
+    Octree tree;
+    tree.quadrupole = quadrupole;
+    tree.build(bodies);
+    return measureForceErrorOf(bodies, G, [&](int i) { return tree.accelOn(bodies, i, G, theta); }, maxSamples);
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "body.h"
+#include "initialconditions.h"
+#include "threadpool.h"
+#include "directsum.h"
+#include "barneshut.h"
+#include "lbvh.h"
+
+// best of `reps` wall-clock runs, in seconds
+template <typename F>
+double timeBest(int reps, F&& f)
+{
+    double best = 1e30;
+    for (int r = 0; r < reps; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+    }
+    return best;
+}
+
+// Strong scaling of the force evaluation: the same random cube is solved with
+// 1, 2, 4 ... maxThreads workers and the speedup over one thread is printed.
+inline void runThreadScalingBenchmark(int numBodies, int maxThreads)
+{
+    if (maxThreads <= 0)
+        maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<int> counts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxThreads);
+
+    BodySoA bodies = makeUniformCube(numBodies, 1234);
+    Octree tree;
+    const float G = 1.0f;
+    const float theta = 0.5f;
+
+    std::printf("Thread scaling, %d bodies, %s kernel\n", numBodies, simdLevelNames[activeSimdLevel()]);
+    std::printf("%8s %12s %8s %8s %12s %8s %8s\n", "threads", "direct ms", "speedup", "eff", "tree ms", "speedup", "eff");
+    double direct1 = 0.0, tree1 = 0.0, directLast = 0.0;
+    for (int t : counts) {
+        ThreadPool pool(t);
+        double direct = timeBest(3, [&] { computeAccelDirect(bodies, G, pool); });
+        double walk = timeBest(3, [&] { computeAccelBarnesHut(tree, bodies, G, theta, pool); });
+        if (t == 1) {
+            direct1 = direct;
+            tree1 = walk;
+        }
+        directLast = direct;
+        std::printf("%8d %12.2f %8.2f %7.0f%% %12.2f %8.2f %7.0f%%\n", t,
+            direct * 1e3, direct1 / direct, 100.0 * direct1 / direct / t,
+            walk * 1e3, tree1 / walk, 100.0 * tree1 / walk / t);
+    }
+    std::printf("direct sum at %d threads: %.2f G interactions/s\n", counts.back(),
+        (double)numBodies * numBodies / directLast * 1e-9);
+}
+
+// Tree construction only: the recursive octree builder, which runs on one
+// thread, against the linear BVH builder on 1, 2, 4 ... maxThreads workers.
+inline void runTreeBuildBenchmark(int numBodies, int maxThreads)
+{
+    if (maxThreads <= 0)
+        maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<int> counts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxThreads);
+
+    BodySoA bodies = makeUniformCube(numBodies, 1234);
+    Octree octree;
+    const double octreeMs = 1e3 * timeBest(3, [&] { octree.build(bodies); });
+    std::printf("Tree build, %d bodies\n", numBodies);
+    std::printf("octree (1 thread): %.2f ms, %zu nodes of %zu bytes, %.1f bytes/body\n", octreeMs,
+        octree.nodes.size(), sizeof(OctreeNode), (double)octree.memoryBytes() / numBodies);
+    std::printf("%8s %10s %8s %8s %8s %10s %10s %8s\n", "threads", "LBVH ms", "keys", "sort", "hier", "moments", "vs octree", "eff");
+    double lbvh1 = 0.0;
+    for (int t : counts) {
+        ThreadPool pool(t);
+        LinearBvh lbvh;
+        lbvh.build(bodies, pool);
+        const double ms = 1e3 * timeBest(3, [&] { lbvh.build(bodies, pool); });
+        if (t == 1)
+            lbvh1 = ms;
+        const LbvhTimings& p = lbvh.timings;
+        std::printf("%8d %10.2f %8.2f %8.2f %8.2f %10.2f %9.2fx %7.0f%%\n", t, ms,
+            p.keys, p.sort, p.hierarchy, p.moments, octreeMs / ms, 100.0 * lbvh1 / ms / t);
+        if (t == counts.back())
+            std::printf("LBVH: %.1f bytes/body\n", (double)lbvh.memoryBytes() / numBodies);
+    }
+}
+
+#endif
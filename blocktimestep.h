@@ -0,0 +1,224 @@
+#ifndef BLOCKTIMESTEP_H
+#define BLOCKTIMESTEP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "integrator.h"
+
+// Kick-drift-kick leapfrog with individual power-of-two timesteps. One call to
+// step() covers dt; a body on level L takes steps of dt / 2^L, and only bodies
+// whose step ends at a given sub-step boundary get new forces there. Everyone
+// is drifted together (drifting is cheap), so sources are always at the current
+// time. Levels come from the acceleration/jerk ratio, eta * |a| / |da/dt|, with
+// the jerk taken from the change in acceleration over the body's last step. A
+// body may move to a finer level at any of its boundaries but only to a
+// coarser one where that level's steps line up. Bodies are kept in an index
+// list sorted by level, finest first, so the set due at any boundary is a
+// prefix of that list.
+class BlockTimestepLeapfrog : public Integrator
+{
+public:
+    float eta = 0.05f;
+    int maxLevel = 6;
+
+    // per call to step()
+    long long lastForceEvals = 0;
+    long long lastForceSubsteps = 0;
+    std::vector<int> levelCounts;
+
+    void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) override
+    {
+        const size_t n = bodies.size();
+        maxLevel = std::max(0, std::min(maxLevel, 20));
+        if (!primed || level.size() != n)
+            prime(bodies, dt, accel, pool);
+        for (size_t i = 0; i < n; i++)
+            level[i] = (uint8_t)std::min<int>(level[i], maxLevel);
+        sortByLevel();
+
+        const long long nsub = 1LL << maxLevel;
+        const float dtMin = dt / (float)nsub;
+        lastForceEvals = 0;
+        lastForceSubsteps = 0;
+
+        // everyone starts a step together at the beginning of the block
+        halfKick(bodies, order, order.size(), dt, pool);
+
+        float pendingDrift = 0.0f;
+        for (long long b = 1; b <= nsub; b++) {
+            pendingDrift += dtMin;
+            // bodies whose step ends at boundary b: levels >= maxLevel - trailingZeros(b)
+            int tz = 0;
+            while (((b >> tz) & 1) == 0 && tz < maxLevel)
+                tz++;
+            const int threshold = maxLevel - tz;
+            const size_t count = countAtLeast[threshold];
+            if (count == 0)
+                continue;
+
+            drift(bodies, pendingDrift, pool);
+            pendingDrift = 0.0f;
+
+            active.assign(order.begin(), order.begin() + count);
+            accel(bodies, &active);
+            lastForceEvals += (long long)count;
+            lastForceSubsteps++;
+
+            halfKick(bodies, active, count, dt, pool);
+            if (b == nsub)
+                break;
+            chooseLevels(bodies, active, dt, b, pool);
+            sortByLevel();
+            // the same bodies open their next step straight away with their new level
+            halfKick(bodies, active, count, dt, pool);
+        }
+        if (pendingDrift > 0.0f)
+            drift(bodies, pendingDrift, pool);
+
+        // the block is over and everyone is synchronised again: pick next levels
+        chooseLevels(bodies, order, dt, nsub, pool);
+
+        levelCounts.assign(maxLevel + 1, 0);
+        for (size_t i = 0; i < n; i++)
+            levelCounts[level[i]]++;
+    }
+
+    void reset() override { primed = false; }
+
+    void reorder(const std::vector<int>& perm) override
+    {
+        if (!primed || level.size() != perm.size())
+            return;
+        gather(level, perm);
+        gather(lastAx, perm);
+        gather(lastAy, perm);
+        gather(lastAz, perm);
+        gather(lastDt, perm);
+    }
+
+private:
+    bool primed = false;
+    std::vector<uint8_t> level;
+    std::vector<float> lastAx, lastAy, lastAz, lastDt;
+    std::vector<int> order, active, scratch;
+    std::vector<size_t> countAtLeast;
+
+    template <typename T>
+    static void gather(std::vector<T>& v, const std::vector<int>& perm)
+    {
+        std::vector<T> out(v.size());
+        for (size_t i = 0; i < perm.size(); i++)
+            out[i] = v[perm[i]];
+        v.swap(out);
+    }
+
+    float stepOf(int L, float dt) const { return dt / (float)(1LL << L); }
+
+    void halfKick(BodySoA& bodies, const std::vector<int>& list, size_t count, float dt, ThreadPool& pool)
+    {
+        pool.parallelFor(count, 4096, [&](size_t b, size_t e, int) {
+            for (size_t k = b; k < e; k++) {
+                int i = list[k];
+                float h = 0.5f * stepOf(level[i], dt);
+                bodies.vx[i] += bodies.ax[i] * h;
+                bodies.vy[i] += bodies.ay[i] * h;
+                bodies.vz[i] += bodies.az[i] * h;
+            }
+        });
+    }
+
+    int desiredLevel(float a2, float j2, float dt) const
+    {
+        if (j2 <= 0.0f || a2 <= 0.0f)
+            return 0;
+        float want = eta * std::sqrt(a2 / j2);
+        if (want >= dt)
+            return 0;
+        int L = (int)std::ceil(std::log2(dt / want));
+        return std::min(std::max(L, 0), maxLevel);
+    }
+
+    // new levels for bodies at boundary b (in units of the finest step)
+    void chooseLevels(BodySoA& bodies, const std::vector<int>& list, float dt, long long b, ThreadPool& pool)
+    {
+        pool.parallelFor(list.size(), 4096, [&](size_t lo, size_t hi, int) {
+            for (size_t k = lo; k < hi; k++) {
+                int i = list[k];
+                float jx = (bodies.ax[i] - lastAx[i]) / lastDt[i];
+                float jy = (bodies.ay[i] - lastAy[i]) / lastDt[i];
+                float jz = (bodies.az[i] - lastAz[i]) / lastDt[i];
+                float a2 = bodies.ax[i] * bodies.ax[i] + bodies.ay[i] * bodies.ay[i] + bodies.az[i] * bodies.az[i];
+                int want = desiredLevel(a2, jx * jx + jy * jy + jz * jz, dt);
+
+                int L = level[i];
+                if (want > L) {
+                    L = want;
+                }
+                else if (want < L) {
+                    // coarsen one level at a time, and only where the coarser step starts
+                    long long span = 1LL << (maxLevel - (L - 1));
+                    if (b % span == 0)
+                        L--;
+                }
+                level[i] = (uint8_t)L;
+                lastAx[i] = bodies.ax[i];
+                lastAy[i] = bodies.ay[i];
+                lastAz[i] = bodies.az[i];
+                lastDt[i] = stepOf(L, dt);
+            }
+        });
+    }
+
+    // counting sort of the body list by level, finest level first
+    void sortByLevel()
+    {
+        const size_t n = level.size();
+        std::vector<size_t> counts(maxLevel + 2, 0);
+        for (size_t i = 0; i < n; i++)
+            counts[level[i]]++;
+        countAtLeast.assign(maxLevel + 2, 0);
+        for (int L = maxLevel; L >= 0; L--)
+            countAtLeast[L] = countAtLeast[L + 1] + counts[L];
+        std::vector<size_t> cursor(maxLevel + 1);
+        for (int L = 0; L <= maxLevel; L++)
+            cursor[L] = countAtLeast[L + 1];
+        scratch.resize(n);
+        for (size_t i = 0; i < n; i++)
+            scratch[cursor[level[i]]++] = (int)i;
+        order.swap(scratch);
+    }
+
+    // Fresh forces for everyone, plus a jerk estimate from a short trial drift
+    // so the very first levels are already sensible.
+    void prime(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool)
+    {
+        const size_t n = bodies.size();
+        level.assign(n, 0);
+        order.resize(n);
+        for (size_t i = 0; i < n; i++)
+            order[i] = (int)i;
+
+        const float probe = dt / (float)(1LL << maxLevel);
+        AlignedVector<float> x0 = bodies.x, y0 = bodies.y, z0 = bodies.z;
+        drift(bodies, probe, pool);
+        accel(bodies, nullptr);
+        lastAx.assign(bodies.ax.begin(), bodies.ax.end());
+        lastAy.assign(bodies.ay.begin(), bodies.ay.end());
+        lastAz.assign(bodies.az.begin(), bodies.az.end());
+        bodies.x = x0;
+        bodies.y = y0;
+        bodies.z = z0;
+        accel(bodies, nullptr);
+
+        // jerk ~ (a(0) - a(probe)) / probe; only its size matters
+        lastDt.assign(n, probe);
+        chooseLevels(bodies, order, dt, 0, pool);
+        primed = true;
+    }
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef BODY_H
+#define BODY_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+struct Body {
+    glm::vec3 pos;
+    glm::vec3 vel;
+    float mass;
+    glm::vec3 color;
+};
+
+// std::vector allocator that hands out memory aligned to a cache line, so the
+// physics arrays can be read with aligned vector loads.
+template <typename T, std::size_t Align = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    T* allocate(std::size_t n)
+    {
+        std::size_t bytes = (n * sizeof(T) + Align - 1) / Align * Align;
+#ifdef _MSC_VER
+        void* p = _aligned_malloc(bytes, Align);
+#else
+        void* p = nullptr;
+        if (posix_memalign(&p, Align, bytes) != 0)
+            p = nullptr;
+#endif
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+#ifdef _MSC_VER
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Structure-of-arrays body storage. The force loop only touches x/y/z/mass, so
+// those sit in their own aligned arrays; velocities and the accelerations from
+// the last force evaluation are separate again, and the colour, which physics
+// never reads, is kept off to the side. id is each body's original index: it
+// travels with the body when the arrays are reordered, and is what the
+// renderer and output files go by.
+class BodySoA
+{
+public:
+    AlignedVector<float> x, y, z, mass;
+    AlignedVector<float> vx, vy, vz;
+    AlignedVector<float> ax, ay, az;
+    std::vector<glm::vec3> color;
+    std::vector<int> id;
+
+    BodySoA() {}
+    explicit BodySoA(const std::vector<Body>& bodies)
+    {
+        reserve(bodies.size());
+        for (const Body& b : bodies)
+            push_back(b);
+    }
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    void reserve(size_t n)
+    {
+        x.reserve(n); y.reserve(n); z.reserve(n); mass.reserve(n);
+        vx.reserve(n); vy.reserve(n); vz.reserve(n);
+        ax.reserve(n); ay.reserve(n); az.reserve(n);
+        color.reserve(n);
+        id.reserve(n);
+    }
+
+    void resize(size_t n)
+    {
+        x.resize(n); y.resize(n); z.resize(n); mass.resize(n);
+        vx.resize(n); vy.resize(n); vz.resize(n);
+        ax.resize(n); ay.resize(n); az.resize(n);
+        color.resize(n);
+        const size_t old = id.size();
+        id.resize(n);
+        for (size_t i = old; i < n; i++)
+            id[i] = (int)i;
+    }
+
+    void clear() { resize(0); }
+
+    void zeroAcc()
+    {
+        std::fill(ax.begin(), ax.end(), 0.0f);
+        std::fill(ay.begin(), ay.end(), 0.0f);
+        std::fill(az.begin(), az.end(), 0.0f);
+    }
+
+    void push_back(const Body& b)
+    {
+        x.push_back(b.pos.x); y.push_back(b.pos.y); z.push_back(b.pos.z);
+        mass.push_back(b.mass);
+        vx.push_back(b.vel.x); vy.push_back(b.vel.y); vz.push_back(b.vel.z);
+        ax.push_back(0.0f); ay.push_back(0.0f); az.push_back(0.0f);
+        color.push_back(b.color);
+        id.push_back((int)id.size());
+    }
+
+    // reorder every array so slot i holds what was in slot order[i]
+    void permute(const std::vector<int>& order)
+    {
+        permuteArray(x, order); permuteArray(y, order); permuteArray(z, order); permuteArray(mass, order);
+        permuteArray(vx, order); permuteArray(vy, order); permuteArray(vz, order);
+        permuteArray(ax, order); permuteArray(ay, order); permuteArray(az, order);
+        permuteArray(color, order);
+        permuteArray(id, order);
+    }
+
+    glm::vec3 pos(size_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+    glm::vec3 vel(size_t i) const { return glm::vec3(vx[i], vy[i], vz[i]); }
+    glm::vec3 acc(size_t i) const { return glm::vec3(ax[i], ay[i], az[i]); }
+    void setPos(size_t i, const glm::vec3& p) { x[i] = p.x; y[i] = p.y; z[i] = p.z; }
+    void setVel(size_t i, const glm::vec3& v) { vx[i] = v.x; vy[i] = v.y; vz[i] = v.z; }
+
+    // adapter for code that still thinks in terms of Body
+    Body get(size_t i) const { return { pos(i), vel(i), mass[i], color[i] }; }
+    void set(size_t i, const Body& b)
+    {
+        setPos(i, b.pos);
+        setVel(i, b.vel);
+        mass[i] = b.mass;
+        color[i] = b.color;
+    }
+    Body operator[](size_t i) const { return get(i); }
+
+    std::vector<Body> toAoS() const
+    {
+        std::vector<Body> out;
+        out.reserve(size());
+        for (size_t i = 0; i < size(); i++)
+            out.push_back(get(i));
+        return out;
+    }
+
+    // lets `for (Body b : soa)` keep working
+    class const_iterator
+    {
+    public:
+        const_iterator(const BodySoA* soa, size_t i) : soa(soa), i(i) {}
+        Body operator*() const { return soa->get(i); }
+        const_iterator& operator++() { ++i; return *this; }
+        bool operator==(const const_iterator& o) const { return i == o.i; }
+        bool operator!=(const const_iterator& o) const { return i != o.i; }
+    private:
+        const BodySoA* soa;
+        size_t i;
+    };
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+private:
+    template <typename V>
+    static void permuteArray(V& v, const std::vector<int>& order)
+    {
+        V out(v.size());
+        for (size_t i = 0; i < order.size(); i++)
+            out[i] = v[order[i]];
+        v.swap(out);
+    }
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ORBO_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit AVX instructions inside functions that ask for them;
+// MSVC allows the intrinsics anywhere, so the attribute is a no-op there.
+#if defined(__GNUC__) || defined(__clang__)
+#define ORBO_TARGET(x) __attribute__((target(x)))
+#else
+#define ORBO_TARGET(x)
+#endif
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+const char* const simdLevelNames[] = { "scalar", "SSE", "AVX2", "AVX-512" };
+
+#ifdef ORBO_X86
+inline void cpuid(int leaf, int sub, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, sub);
+    for (int k = 0; k < 4; k++)
+        regs[k] = (unsigned int)r[k];
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+inline unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+
+// Best instruction set both the CPU and the OS (saved register state) support.
+inline SimdLevel detectSimdLevel()
+{
+#ifdef ORBO_X86
+    unsigned int r[4];
+    cpuid(0, 0, r);
+    const unsigned int maxLeaf = r[0];
+
+    cpuid(1, 0, r);
+    const bool sse41 = (r[2] >> 19) & 1;
+    const bool fma = (r[2] >> 12) & 1;
+    const bool osxsave = (r[2] >> 27) & 1;
+    const bool avx = (r[2] >> 28) & 1;
+    SimdLevel level = sse41 ? SIMD_SSE : SIMD_SCALAR;
+
+    if (!osxsave || !avx || maxLeaf < 7)
+        return level;
+    const unsigned long long xcr0 = xgetbv0();
+    if ((xcr0 & 0x6) != 0x6)
+        return level;
+
+    cpuid(7, 0, r);
+    const bool avx2 = (r[1] >> 5) & 1;
+    const bool avx512f = (r[1] >> 16) & 1;
+    if (avx2 && fma)
+        level = SIMD_AVX2;
+    if (level == SIMD_AVX2 && avx512f && (xcr0 & 0xE0) == 0xE0)
+        level = SIMD_AVX512;
+    return level;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef DIRECTSUM_H
+#define DIRECTSUM_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include "body.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+
+// Plummer softening length squared, so close pairs don't blow up
+const float SOFTENING = 1e-5f;
+
+// acceleration of body i from every other body, O(N). Always the plain scalar
+// kernel: this is the reference the approximate solvers are checked against.
+inline glm::vec3 directAccelOn(const BodySoA& bodies, size_t i, float G) {
+    float a[3] = { 0.0f, 0.0f, 0.0f };
+    accelKernelScalar(&bodies.x[i], &bodies.y[i], &bodies.z[i], 1,
+                      bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), bodies.size(),
+                      G, SOFTENING, &a[0], &a[1], &a[2]);
+    return glm::vec3(a[0], a[1], a[2]);
+}
+
+// fills bodies.ax/ay/az with the O(N^2) direct sum using the kernel picked at
+// startup, handing out blocks of targets to the pool
+inline void computeAccelDirect(BodySoA& bodies, float G, ThreadPool& pool) {
+    bodies.zeroAcc();
+    const AccelKernel kernel = activeAccelKernel();
+    pool.parallelFor(bodies.size(), 64, [&](size_t b, size_t e, int) {
+        kernel(&bodies.x[b], &bodies.y[b], &bodies.z[b], e - b,
+               bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), bodies.size(),
+               G, SOFTENING, &bodies.ax[b], &bodies.ay[b], &bodies.az[b]);
+    });
+}
+
+// Same as computeAccelDirect, but only the bodies listed in active get new
+// accelerations. Each chunk of targets is gathered into a small contiguous block
+// so the kernel still streams over all sources.
+inline void computeAccelDirect(BodySoA& bodies, float G, ThreadPool& pool, const std::vector<int>& active) {
+    const AccelKernel kernel = activeAccelKernel();
+    const size_t chunk = 64;
+    pool.parallelFor(active.size(), chunk, [&](size_t b, size_t e, int) {
+        // a range can be longer than one chunk (a single-thread pool runs it all inline)
+        for (size_t c0 = b; c0 < e; c0 += chunk) {
+            const size_t c1 = std::min(e, c0 + chunk);
+            float tx[chunk], ty[chunk], tz[chunk], ax[chunk] = {}, ay[chunk] = {}, az[chunk] = {};
+            for (size_t k = c0; k < c1; k++) {
+                int i = active[k];
+                tx[k - c0] = bodies.x[i];
+                ty[k - c0] = bodies.y[i];
+                tz[k - c0] = bodies.z[i];
+            }
+            kernel(tx, ty, tz, c1 - c0,
+                   bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), bodies.size(),
+                   G, SOFTENING, ax, ay, az);
+            for (size_t k = c0; k < c1; k++) {
+                int i = active[k];
+                bodies.ax[i] = ax[k - c0];
+                bodies.ay[i] = ay[k - c0];
+                bodies.az[i] = az[k - c0];
+            }
+        }
+    });
+}
+
+// kinetic plus softened potential energy, O(N^2); for diagnostics only
+inline double totalEnergy(const BodySoA& bodies, float G, ThreadPool& pool) {
+    const size_t n = bodies.size();
+    std::vector<double> partial(pool.size(), 0.0);
+    pool.parallelFor(n, 16, [&](size_t b, size_t e, int worker) {
+        double sum = 0.0;
+        for (size_t i = b; i < e; i++) {
+            double v2 = (double)bodies.vx[i] * bodies.vx[i] + (double)bodies.vy[i] * bodies.vy[i] + (double)bodies.vz[i] * bodies.vz[i];
+            sum += 0.5 * bodies.mass[i] * v2;
+            double pot = 0.0;
+            for (size_t j = i + 1; j < n; j++) {
+                double dx = bodies.x[j] - bodies.x[i], dy = bodies.y[j] - bodies.y[i], dz = bodies.z[j] - bodies.z[i];
+                pot += bodies.mass[j] / std::sqrt(dx * dx + dy * dy + dz * dz + SOFTENING);
+            }
+            sum -= (double)G * bodies.mass[i] * pot;
+        }
+        partial[worker] += sum;
+    });
+    double total = 0.0;
+    for (double p : partial)
+        total += p;
+    return total;
+}
+
+// total momentum, and in scale the sum of |m v| it should be compared against
+inline glm::dvec3 totalMomentum(const BodySoA& bodies, double* scale = nullptr) {
+    glm::dvec3 p(0.0);
+    double s = 0.0;
+    for (size_t i = 0; i < bodies.size(); i++) {
+        const glm::dvec3 pi = (double)bodies.mass[i] * glm::dvec3(bodies.vx[i], bodies.vy[i], bodies.vz[i]);
+        p += pi;
+        s += glm::length(pi);
+    }
+    if (scale)
+        *scale = s;
+    return p;
+}
+
+// Direct sum that visits every unordered pair once and applies equal and
+// opposite pulls. Workers never share an output array: each one accumulates
+// into its own buffer, and the buffers are summed (and scaled by G) at the end.
+// The pair triangle is cut into blocks of PAIR_BLOCK rows, and blocks are handed
+// out in mirrored pairs (b, last-b) so every task covers about the same work.
+class SymmetricDirectSum
+{
+public:
+    void compute(BodySoA& bodies, float G, ThreadPool& pool)
+    {
+        const size_t n = bodies.size();
+        const int threads = pool.size();
+        if (bufX.size() != (size_t)threads) {
+            bufX.resize(threads);
+            bufY.resize(threads);
+            bufZ.resize(threads);
+        }
+        for (int t = 0; t < threads; t++) {
+            bufX[t].assign(n, 0.0f);
+            bufY[t].assign(n, 0.0f);
+            bufZ[t].assign(n, 0.0f);
+        }
+
+        const PairBlockKernel kernel = activePairBlockKernel();
+        const float* x = bodies.x.data();
+        const float* y = bodies.y.data();
+        const float* z = bodies.z.data();
+        const float* m = bodies.mass.data();
+        const size_t blocks = (n + PAIR_BLOCK - 1) / PAIR_BLOCK;
+
+        auto rowBlock = [&](size_t blk, float* ax, float* ay, float* az) {
+            size_t i0 = blk * PAIR_BLOCK;
+            size_t ni = std::min((size_t)PAIR_BLOCK, n - i0);
+            // pairs inside the block, then the block against everything after it
+            for (size_t r = 1; r < ni; r++)
+                pairBlockKernelScalar(x, y, z, m, i0 + r - 1, 1, i0 + r, i0 + ni, SOFTENING, ax, ay, az);
+            kernel(x, y, z, m, i0, ni, i0 + ni, n, SOFTENING, ax, ay, az);
+        };
+
+        pool.parallelFor((blocks + 1) / 2, 2, [&](size_t b, size_t e, int worker) {
+            float* ax = bufX[worker].data();
+            float* ay = bufY[worker].data();
+            float* az = bufZ[worker].data();
+            for (size_t blk = b; blk < e; blk++) {
+                rowBlock(blk, ax, ay, az);
+                size_t mirror = blocks - 1 - blk;
+                if (mirror > blk)
+                    rowBlock(mirror, ax, ay, az);
+            }
+        });
+
+        pool.parallelFor(n, 4096, [&](size_t b, size_t e, int) {
+            for (size_t i = b; i < e; i++) {
+                float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+                for (int t = 0; t < threads; t++) {
+                    sx += bufX[t][i];
+                    sy += bufY[t][i];
+                    sz += bufZ[t][i];
+                }
+                bodies.ax[i] = G * sx;
+                bodies.ay[i] = G * sy;
+                bodies.az[i] = G * sz;
+            }
+        });
+    }
+
+private:
+    std::vector<AlignedVector<float>> bufX, bufY, bufZ;
+};
+
+#endif
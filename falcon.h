@@ -0,0 +1,267 @@
+#ifndef FALCON_H
+#define FALCON_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include "body.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+#include "directsum.h"
+#include "fmm.h"
+
+// Dehnen's falcON (2000, 2002): the FMM's tree and Cartesian expansions, but
+// every interaction is mutual. The dual tree walk starts from a cell with
+// itself, splits that into its children's self interactions and one mutual
+// interaction per pair of children, and a mutual interaction between two
+// cells either exchanges a single M2L both ways, reusing the one derivative
+// tensor, or is summed directly with the Newton's-third-law pair kernel.
+// Because expansions sit at the centres of mass and are truncated at the same
+// total order both ways, whatever A pulls on B comes back on A with the
+// opposite sign, so the net force is zero to round-off and momentum is kept
+// exactly (Barnes-Hut's walks are one-sided and leave a net force of about
+// its force error). Each pair of cells is visited once instead of twice.
+//
+// Mutual updates write to both cells, so the walk is split up front: the
+// root is opened until there are enough cells to go round, their self
+// interactions run in parallel, and the mutual ones run in rounds of a
+// round-robin tournament where no cell appears twice in a round.
+class Falcon : public FastMultipole
+{
+public:
+    // Accelerations for every body, or only for those listed in active (the
+    // walk covers everyone either way).
+    void compute(BodySoA& bodies, float G, float theta, int order, ThreadPool& pool, const std::vector<int>* active = nullptr)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point start = Clock::now();
+        Clock::time_point mark = start;
+        auto lap = [&](double& slot) {
+            Clock::time_point now = Clock::now();
+            slot = std::chrono::duration<double, std::milli>(now - mark).count();
+            mark = now;
+        };
+
+        const size_t n = bodies.size();
+        timings = FmmTimings();
+        if (n == 0)
+            return;
+        // at order 0 the local expansions have no gradient, so no far-field force
+        order = std::max(1, std::min(order, 12));
+        if (terms.order != order)
+            terms.build(order);
+        nterms = terms.size();
+
+        buildTree(bodies, pool);
+        lap(timings.build);
+        upwardPass(pool);
+        lap(timings.upward);
+        mutualWalk(theta, pool);
+        lap(timings.traverse);
+        downwardPass(pool);
+        lap(timings.downward);
+
+        // the pair kernel leaves G out
+        pool.parallelFor(leaves.size(), 4, [&](size_t b, size_t e, int) {
+            std::vector<double> pw(nterms);
+            for (size_t k = b; k < e; k++) {
+                const OctreeNode& on = tree.nodes[leaves[k]];
+                for (int s = on.begin; s < on.begin + on.count; s++) {
+                    accX[s] *= G;
+                    accY[s] *= G;
+                    accZ[s] *= G;
+                }
+                localToBodies(leaves[k], G, pw.data());
+            }
+        });
+        scatter(bodies, pool, active);
+        lap(timings.near);
+        timings.total = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+private:
+    struct Scratch {
+        std::vector<double> T, flipped;
+        long long m2l = 0, p2p = 0;
+    };
+    std::vector<Scratch> scratch;
+    std::vector<int> cells;
+
+    void mutualWalk(float theta, ThreadPool& pool)
+    {
+        directLimit = directBias * (double)terms.transfers.size();
+        const int workers = pool.size();
+        scratch.resize(workers);
+        for (Scratch& s : scratch) {
+            s.T.resize(nterms);
+            s.flipped.resize(nterms);
+            s.m2l = s.p2p = 0;
+        }
+
+        // open cells a level at a time until every worker has a few
+        cells.assign(1, 0);
+        while ((int)cells.size() < 8 * workers) {
+            std::vector<int> next;
+            for (int c : cells) {
+                const OctreeNode& on = tree.nodes[c];
+                if (on.firstChild < 0) {
+                    next.push_back(c);
+                    continue;
+                }
+                for (int k = 0; k < 8; k++) {
+                    if (tree.nodes[on.firstChild + k].count > 0)
+                        next.push_back(on.firstChild + k);
+                }
+            }
+            if (next.size() == cells.size())
+                break;
+            cells.swap(next);
+        }
+
+        pool.parallelFor(cells.size(), 1, [&](size_t b, size_t e, int worker) {
+            for (size_t k = b; k < e; k++)
+                self(cells[k], theta, scratch[worker]);
+        });
+
+        // circle method: slot 0 stays put and the rest rotate, so each round
+        // pairs every cell with a different partner and no cell twice
+        const int slots = (int)cells.size() + ((int)cells.size() & 1);
+        for (int round = 0; round + 1 < slots; round++) {
+            pool.parallelFor(slots / 2, 1, [&](size_t b, size_t e, int worker) {
+                for (size_t i = b; i < e; i++) {
+                    const int p = i == 0 ? 0 : 1 + ((int)i - 1 + round) % (slots - 1);
+                    const int q = 1 + (slots - 2 - (int)i + round) % (slots - 1);
+                    if (p < (int)cells.size() && q < (int)cells.size())
+                        mutual(cells[p], cells[q], theta, scratch[worker]);
+                }
+            });
+        }
+
+        for (const Scratch& s : scratch) {
+            timings.m2lPairs += s.m2l;
+            timings.p2pPairs += s.p2p;
+        }
+    }
+
+    void self(int a, float theta, Scratch& s)
+    {
+        const OctreeNode& on = tree.nodes[a];
+        if (on.firstChild < 0 || 0.5 * on.count * on.count <= directLimit) {
+            directSelf(on);
+            s.p2p++;
+            return;
+        }
+        int child[8];
+        int m = 0;
+        for (int c = 0; c < 8; c++) {
+            if (tree.nodes[on.firstChild + c].count > 0)
+                child[m++] = on.firstChild + c;
+        }
+        for (int i = 0; i < m; i++)
+            self(child[i], theta, s);
+        for (int i = 0; i < m; i++) {
+            for (int j = i + 1; j < m; j++)
+                mutual(child[i], child[j], theta, s);
+        }
+    }
+
+    void mutual(int a, int b, float theta, Scratch& s)
+    {
+        const OctreeNode& na = tree.nodes[a];
+        const OctreeNode& nb = tree.nodes[b];
+        if ((double)na.count * nb.count <= directLimit) {
+            directPair(na, nb);
+            s.p2p++;
+            return;
+        }
+        if (wellSeparated(a, b, theta)) {
+            transfer(a, b, s);
+            s.m2l++;
+            return;
+        }
+        const bool leafA = isLeaf(a), leafB = isLeaf(b);
+        if (leafA && leafB) {
+            directPair(na, nb);
+            s.p2p++;
+            return;
+        }
+        // open the bigger cell, or whichever one can still be opened
+        if (!leafB && (leafA || radius[b] > radius[a])) {
+            for (int c = 0; c < 8; c++) {
+                if (tree.nodes[nb.firstChild + c].count > 0)
+                    mutual(a, nb.firstChild + c, theta, s);
+            }
+        }
+        else {
+            for (int c = 0; c < 8; c++) {
+                if (tree.nodes[na.firstChild + c].count > 0)
+                    mutual(na.firstChild + c, b, theta, s);
+            }
+        }
+    }
+
+    // M2L both ways from one derivative tensor: T_k(-R) = (-1)^|k| T_k(R)
+    void transfer(int a, int b, Scratch& s)
+    {
+        terms.derivatives(cx[a] - cx[b], cy[a] - cy[b], cz[a] - cz[b], SOFTENING, s.T.data());
+        for (int t = 0; t < nterms; t++)
+            s.flipped[t] = (terms.degree[t] & 1) ? -s.T[t] : s.T[t];
+
+        const double* T = s.T.data();
+        const double* F = s.flipped.data();
+        const double* Ma = &multipole[(size_t)a * nterms];
+        const double* Mb = &multipole[(size_t)b * nterms];
+        double* La = &local[(size_t)a * nterms];
+        double* Lb = &local[(size_t)b * nterms];
+        const FmmTerms::Transfer* tr = terms.transfers.data();
+        for (int t = 0; t < nterms; t++) {
+            double sumA = 0.0, sumB = 0.0;
+            for (int q = terms.transferStart[t]; q < terms.transferStart[t + 1]; q++) {
+                sumA += tr[q].coef * Mb[tr[q].k] * T[tr[q].nk];
+                sumB += tr[q].coef * Ma[tr[q].k] * F[tr[q].nk];
+            }
+            La[t] += sumA;
+            Lb[t] += sumB;
+        }
+    }
+
+    // every body of a against every body of b, each pair once
+    void directPair(const OctreeNode& a, const OctreeNode& b)
+    {
+        const PairBlockKernel kernel = activePairBlockKernel();
+        const int end = a.begin + a.count;
+        for (int i0 = a.begin; i0 < end; i0 += PAIR_BLOCK) {
+            const int ni = std::min(PAIR_BLOCK, end - i0);
+            kernel(sortedX.data(), sortedY.data(), sortedZ.data(), sortedM.data(), i0, ni, b.begin, b.begin + b.count,
+                   SOFTENING, accX.data(), accY.data(), accZ.data());
+        }
+    }
+
+    // every pair inside a leaf once, as the pairwise direct sum does it
+    void directSelf(const OctreeNode& a)
+    {
+        const PairBlockKernel kernel = activePairBlockKernel();
+        const int end = a.begin + a.count;
+        for (int i0 = a.begin; i0 < end; i0 += PAIR_BLOCK) {
+            const int ni = std::min(PAIR_BLOCK, end - i0);
+            for (int r = 1; r < ni; r++)
+                pairBlockKernelScalar(sortedX.data(), sortedY.data(), sortedZ.data(), sortedM.data(), i0 + r - 1, 1, i0 + r, i0 + ni,
+                                      SOFTENING, accX.data(), accY.data(), accZ.data());
+            kernel(sortedX.data(), sortedY.data(), sortedZ.data(), sortedM.data(), i0, ni, i0 + ni, end,
+                   SOFTENING, accX.data(), accY.data(), accZ.data());
+        }
+    }
+};
+
+// falcON accelerations for everyone, checked body for body against the direct sum
+inline ForceError measureFalconError(const BodySoA& bodies, float G, float theta, int order, ThreadPool& pool, int maxSamples = 1000)
+{
+    BodySoA copy = bodies;
+    Falcon falcon;
+    falcon.compute(copy, G, theta, order, pool);
+    return measureForceErrorOf(bodies, G, [&](int i) { return copy.acc(i); }, maxSamples);
+}
+
+#endif
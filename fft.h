@@ -0,0 +1,174 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include "threadpool.h"
+
+typedef std::complex<float> cfloat;
+
+// In-place iterative radix-2 FFT of one fixed power-of-two length. Twiddles
+// are worked out in double and stored once, so repeated transforms only pay
+// for the butterflies. Neither direction is scaled.
+class Fft
+{
+public:
+    void init(int length)
+    {
+        n = length;
+        bits = 0;
+        while ((1 << bits) < n)
+            bits++;
+        reversed.resize(n);
+        for (int i = 0; i < n; i++) {
+            int r = 0;
+            for (int b = 0; b < bits; b++)
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            reversed[i] = r;
+        }
+        twiddle.resize(std::max(1, n / 2));
+        const double pi = 3.14159265358979323846;
+        for (int k = 0; k < n / 2; k++)
+            twiddle[k] = cfloat((float)std::cos(-2.0 * pi * k / n), (float)std::sin(-2.0 * pi * k / n));
+    }
+
+    int size() const { return n; }
+
+    void transform(cfloat* data, bool inverse) const
+    {
+        for (int i = 0; i < n; i++) {
+            if (i < reversed[i])
+                std::swap(data[i], data[reversed[i]]);
+        }
+        for (int len = 2; len <= n; len <<= 1) {
+            const int half = len >> 1;
+            const int step = n / len;
+            for (int start = 0; start < n; start += len) {
+                for (int k = 0; k < half; k++) {
+                    // complex multiply spelled out: std::complex's operator*
+                    // goes through the slow inf/NaN-checking path
+                    const float wr = twiddle[k * step].real();
+                    const float wi = inverse ? -twiddle[k * step].imag() : twiddle[k * step].imag();
+                    const cfloat b = data[start + k + half];
+                    const cfloat v(b.real() * wr - b.imag() * wi, b.real() * wi + b.imag() * wr);
+                    const cfloat u = data[start + k];
+                    data[start + k] = u + v;
+                    data[start + k + half] = u - v;
+                }
+            }
+        }
+    }
+
+private:
+    int n = 0;
+    int bits = 0;
+    std::vector<int> reversed;
+    std::vector<cfloat> twiddle;
+};
+
+// 3D FFT of an m x m x m grid stored x-major (index (x * m + y) * m + z), done
+// as 1D transforms along each axis with the lines spread over the pool. The
+// strided axes are copied out a block of neighbouring lines at a time so the
+// reads stay close to contiguous.
+//
+// Both directions can skip lines that don't matter, which is most of them for
+// a zero-padded convolution: forward() can be told the input is zero outside
+// [0, occupied)^3, and inverse() that only indices below keep, and the last
+// behind ones (the wrap-around neighbours of 0), will be read afterwards.
+class Fft3d
+{
+public:
+    void init(int m)
+    {
+        if (line.size() != m)
+            line.init(m);
+    }
+
+    int size() const { return line.size(); }
+
+    void forward(std::vector<cfloat>& grid, ThreadPool& pool, int occupied = 0)
+    {
+        const int m = size();
+        const int o = occupied > 0 ? std::min(occupied, m) : m;
+        auto inside = [o](int i) { return i < o; };
+        auto all = [](int) { return true; };
+        passZ(grid.data(), false, pool, inside, inside);
+        passStrided(grid.data(), 1, false, pool, inside);
+        passStrided(grid.data(), 0, false, pool, all);
+    }
+
+    // scaled by 1 / m^3, so forward then inverse is the identity
+    void inverse(std::vector<cfloat>& grid, ThreadPool& pool, int keep = 0, int behind = 0)
+    {
+        const int m = size();
+        const int k = keep > 0 ? std::min(keep, m) : m;
+        auto wanted = [k, m, behind](int i) { return i < k || i >= m - behind; };
+        auto all = [](int) { return true; };
+        passStrided(grid.data(), 0, true, pool, all);
+        passStrided(grid.data(), 1, true, pool, wanted);
+        passZ(grid.data(), true, pool, wanted, wanted);
+
+        const size_t total = (size_t)m * m * m;
+        const float scale = 1.0f / (float)total;
+        pool.parallelFor(total, 65536, [&](size_t b, size_t e, int) {
+            for (size_t i = b; i < e; i++)
+                grid[i] *= scale;
+        });
+    }
+
+private:
+    static const int BLOCK = 16;
+    Fft line;
+
+    // contiguous z lines, for the (x, y) that pass the filters
+    template <typename FX, typename FY>
+    void passZ(cfloat* data, bool inverse, ThreadPool& pool, FX useX, FY useY)
+    {
+        const int m = size();
+        pool.parallelFor((size_t)m * m, 64, [&](size_t b, size_t e, int) {
+            for (size_t l = b; l < e; l++) {
+                if (useX((int)(l / m)) && useY((int)(l % m)))
+                    line.transform(data + l * m, inverse);
+            }
+        });
+    }
+
+    // y lines (axis 1, filtered on x) or x lines (axis 0, filtered on y),
+    // BLOCK lines of consecutive z at a time
+    template <typename F>
+    void passStrided(cfloat* data, int axis, bool inverse, ThreadPool& pool, F useOuter)
+    {
+        const int m = size();
+        const size_t mm = (size_t)m * m;
+        const size_t stride = axis == 1 ? (size_t)m : mm;
+        const size_t outerStride = axis == 1 ? mm : (size_t)m;
+        const int blocks = (m + BLOCK - 1) / BLOCK;
+        pool.parallelFor((size_t)m * blocks, 4, [&](size_t b, size_t e, int) {
+            std::vector<cfloat> tmp((size_t)BLOCK * m);
+            for (size_t task = b; task < e; task++) {
+                const size_t outer = task / blocks;
+                if (!useOuter((int)outer))
+                    continue;
+                const int z0 = (int)(task % blocks) * BLOCK;
+                const int nz = std::min(BLOCK, m - z0);
+                cfloat* base = data + outer * outerStride + z0;
+                for (int i = 0; i < m; i++) {
+                    const cfloat* src = base + i * stride;
+                    for (int z = 0; z < nz; z++)
+                        tmp[(size_t)z * m + i] = src[z];
+                }
+                for (int z = 0; z < nz; z++)
+                    line.transform(&tmp[(size_t)z * m], inverse);
+                for (int i = 0; i < m; i++) {
+                    cfloat* dst = base + i * stride;
+                    for (int z = 0; z < nz; z++)
+                        dst[z] = tmp[(size_t)z * m + i];
+                }
+            }
+        });
+    }
+};
+
+#endif
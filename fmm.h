@@ -0,0 +1,542 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "body.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+#include "directsum.h"
+#include "barneshut.h"
+
+// wall time of each phase of the last FMM evaluation, in milliseconds
+struct FmmTimings {
+    double build = 0.0;      // octree and sorted body copy
+    double upward = 0.0;     // P2M at leaves, M2M up the tree
+    double traverse = 0.0;   // dual tree walk building the interaction lists
+    double m2l = 0.0;
+    double downward = 0.0;   // L2L down the tree
+    double near = 0.0;       // L2P and P2P at the leaves
+    double total = 0.0;
+    long long m2lPairs = 0;
+    long long p2pPairs = 0;
+};
+
+// Cartesian multi-indices k = (kx, ky, kz) with |k| <= p, ordered by degree so
+// the terms up to any lower degree are a prefix, plus the index tables every
+// expansion operator is driven by.
+struct FmmTerms {
+    int order = -1;
+    std::vector<int> kx, ky, kz, degree;
+    // recurrence for the derivative tensor: k - e_i and k - 2e_i, or -1, and
+    // the weights (2|k| - 1) / |k| and (|k| - 1) / |k|
+    std::vector<int> less1[3], less2[3];
+    std::vector<double> weight1, weight2;
+    // j <= k pairs for M2M and L2L: target k, source j, index of k - j, C(k, j)
+    struct Shift { int k, j, kmj; double coef; };
+    std::vector<Shift> shifts;
+    // |n| + |k| <= p pairs for M2L: C(n + k, n) (-1)^|n|, grouped by n;
+    // the pairs for term n are transfers[transferStart[n], transferStart[n + 1])
+    struct Transfer { int k, nk; double coef; };
+    std::vector<Transfer> transfers;
+    std::vector<int> transferStart;
+
+    int size() const { return (int)kx.size(); }
+    int index(int a, int b, int c) const
+    {
+        if (a < 0 || b < 0 || c < 0 || a + b + c > order)
+            return -1;
+        return lookup[(a * (order + 1) + b) * (order + 1) + c];
+    }
+
+    void build(int p)
+    {
+        order = p;
+        kx.clear(); ky.clear(); kz.clear(); degree.clear();
+        lookup.assign((p + 1) * (p + 1) * (p + 1), -1);
+        for (int d = 0; d <= p; d++) {
+            for (int a = d; a >= 0; a--) {
+                for (int b = d - a; b >= 0; b--) {
+                    int c = d - a - b;
+                    lookup[(a * (p + 1) + b) * (p + 1) + c] = (int)kx.size();
+                    kx.push_back(a); ky.push_back(b); kz.push_back(c); degree.push_back(d);
+                }
+            }
+        }
+        const int n = size();
+        for (int i = 0; i < 3; i++) {
+            less1[i].assign(n, -1);
+            less2[i].assign(n, -1);
+        }
+        weight1.assign(n, 0.0);
+        weight2.assign(n, 0.0);
+        for (int t = 0; t < n; t++) {
+            if (degree[t] > 0) {
+                weight1[t] = (2.0 * degree[t] - 1.0) / degree[t];
+                weight2[t] = (degree[t] - 1.0) / degree[t];
+            }
+            less1[0][t] = index(kx[t] - 1, ky[t], kz[t]);
+            less1[1][t] = index(kx[t], ky[t] - 1, kz[t]);
+            less1[2][t] = index(kx[t], ky[t], kz[t] - 1);
+            less2[0][t] = index(kx[t] - 2, ky[t], kz[t]);
+            less2[1][t] = index(kx[t], ky[t] - 2, kz[t]);
+            less2[2][t] = index(kx[t], ky[t], kz[t] - 2);
+        }
+
+        shifts.clear();
+        for (int k = 0; k < n; k++) {
+            for (int j = 0; j < n; j++) {
+                if (kx[j] > kx[k] || ky[j] > ky[k] || kz[j] > kz[k])
+                    continue;
+                double coef = binomial(kx[k], kx[j]) * binomial(ky[k], ky[j]) * binomial(kz[k], kz[j]);
+                shifts.push_back({ k, j, index(kx[k] - kx[j], ky[k] - ky[j], kz[k] - kz[j]), coef });
+            }
+        }
+
+        transfers.clear();
+        transferStart.assign(n + 1, 0);
+        for (int t = 0; t < n; t++) {
+            transferStart[t] = (int)transfers.size();
+            for (int k = 0; k < n; k++) {
+                if (degree[t] + degree[k] > p)
+                    continue;
+                double coef = binomial(kx[t] + kx[k], kx[t]) * binomial(ky[t] + ky[k], ky[t]) * binomial(kz[t] + kz[k], kz[t]);
+                if (degree[t] & 1)
+                    coef = -coef;
+                transfers.push_back({ k, index(kx[t] + kx[k], ky[t] + ky[k], kz[t] + kz[k]), coef });
+            }
+        }
+        transferStart[n] = (int)transfers.size();
+    }
+
+    // d^k for every term, built up from lower-degree products
+    void powers(double dx, double dy, double dz, double* out) const
+    {
+        out[0] = 1.0;
+        for (int t = 1; t < size(); t++) {
+            if (less1[0][t] >= 0)
+                out[t] = out[less1[0][t]] * dx;
+            else if (less1[1][t] >= 0)
+                out[t] = out[less1[1][t]] * dy;
+            else
+                out[t] = out[less1[2][t]] * dz;
+        }
+    }
+
+    // T_k(R) = (-1)^|k| / k! d^k/dR^k (R^2 + eps2)^(-1/2), from the recurrence
+    // |k| r^2 T_k = (2|k| - 1) sum_i R_i T_{k-e_i} - (|k| - 1) sum_i T_{k-2e_i}
+    void derivatives(double rx, double ry, double rz, double eps2, double* out) const
+    {
+        const double r2 = rx * rx + ry * ry + rz * rz + eps2;
+        const double inv = 1.0 / r2;
+        const double R[3] = { rx, ry, rz };
+        out[0] = std::sqrt(inv);
+        for (int t = 1; t < size(); t++) {
+            double s1 = 0.0, s2 = 0.0;
+            for (int i = 0; i < 3; i++) {
+                if (less1[i][t] >= 0)
+                    s1 += R[i] * out[less1[i][t]];
+                if (less2[i][t] >= 0)
+                    s2 += out[less2[i][t]];
+            }
+            out[t] = (weight1[t] * s1 - weight2[t] * s2) * inv;
+        }
+    }
+
+private:
+    std::vector<int> lookup;
+
+    static double binomial(int n, int k)
+    {
+        double r = 1.0;
+        for (int i = 1; i <= k; i++)
+            r = r * (n - k + i) / i;
+        return r;
+    }
+};
+
+// Fast multipole method with Cartesian Taylor expansions of runtime order p.
+// The bodies are partitioned with the same octree as Barnes-Hut, but with
+// bigger leaves. Each cell carries a multipole expansion about its centre of
+// mass (P2M at leaves, M2M upwards) and a local expansion about the same point.
+// A dual tree walk pairs up cells: well separated pairs, (r_A + r_B) < theta *
+// distance, exchange a single M2L; pairs of leaves that are too close, and
+// pairs of cells too small for an expansion to pay off, get the direct sum (P2P). Local expansions are then pushed down (L2L) and evaluated
+// at the bodies (L2P). The amount of work per body does not grow with N.
+class FastMultipole
+{
+public:
+    int leafSize = 32;
+    // a pair of cells with fewer than directBias interactions per M2L term
+    // between them is summed directly: small cells are cheaper that way, and
+    // exact. With the SIMD P2P kernel an M2L term costs a few interactions.
+    float directBias = 4.0f;
+    FmmTimings timings;
+
+    // Accelerations for every body, or only for those listed in active (the
+    // expansions still cover everyone, so the cost is the same either way).
+    void compute(BodySoA& bodies, float G, float theta, int order, ThreadPool& pool, const std::vector<int>* active = nullptr)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point start = Clock::now();
+        Clock::time_point mark = start;
+        auto lap = [&](double& slot) {
+            Clock::time_point now = Clock::now();
+            slot = std::chrono::duration<double, std::milli>(now - mark).count();
+            mark = now;
+        };
+
+        const size_t n = bodies.size();
+        timings = FmmTimings();
+        if (n == 0)
+            return;
+        // the forces come from the gradient of the local expansion, which an
+        // order-0 expansion doesn't have
+        order = std::max(1, std::min(order, 12));
+        if (terms.order != order)
+            terms.build(order);
+        nterms = terms.size();
+
+        buildTree(bodies, pool);
+        lap(timings.build);
+        upwardPass(pool);
+        lap(timings.upward);
+        buildInteractionLists(theta);
+        lap(timings.traverse);
+        transferPass(pool);
+        lap(timings.m2l);
+        downwardPass(pool);
+        lap(timings.downward);
+        nearPass(G, pool);
+        scatter(bodies, pool, active);
+        lap(timings.near);
+        timings.total = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+protected:
+    Octree tree;
+    FmmTerms terms;
+    int nterms = 0;
+
+    // bodies copied into tree order so a leaf's bodies are contiguous
+    AlignedVector<float> sortedX, sortedY, sortedZ, sortedM;
+    AlignedVector<float> accX, accY, accZ;
+    std::vector<int> slotOf;
+
+    // per node: expansion centre, radius of the bodies around it, expansions
+    std::vector<double> cx, cy, cz, radius;
+    std::vector<double> multipole, local;
+    std::vector<std::vector<int>> levels;
+
+    // interaction lists in compressed rows, indexed by target node
+    std::vector<std::pair<int, int>> m2lPairs, p2pPairs;
+    std::vector<int> m2lStart, m2lSource, p2pStart, p2pSource;
+    std::vector<int> leaves, parent;
+    double directLimit = 0.0;
+
+    // accelerations back to the caller's ordering
+    void scatter(BodySoA& bodies, ThreadPool& pool, const std::vector<int>* active)
+    {
+        if (active) {
+            pool.parallelFor(active->size(), 4096, [&](size_t b, size_t e, int) {
+                for (size_t k = b; k < e; k++) {
+                    int i = (*active)[k];
+                    int s = slotOf[i];
+                    bodies.ax[i] = accX[s];
+                    bodies.ay[i] = accY[s];
+                    bodies.az[i] = accZ[s];
+                }
+            });
+        }
+        else {
+            pool.parallelFor(bodies.size(), 4096, [&](size_t b, size_t e, int) {
+                for (size_t s = b; s < e; s++) {
+                    int i = tree.order[s];
+                    bodies.ax[i] = accX[s];
+                    bodies.ay[i] = accY[s];
+                    bodies.az[i] = accZ[s];
+                }
+            });
+        }
+    }
+
+    bool isLeaf(int node) const { return tree.nodes[node].firstChild < 0; }
+
+    void buildTree(const BodySoA& bodies, ThreadPool& pool)
+    {
+        const size_t n = bodies.size();
+        tree.leafSize = leafSize;
+        tree.build(bodies);
+
+        sortedX.resize(n); sortedY.resize(n); sortedZ.resize(n); sortedM.resize(n);
+        accX.assign(n, 0.0f); accY.assign(n, 0.0f); accZ.assign(n, 0.0f);
+        slotOf.resize(n);
+        pool.parallelFor(n, 4096, [&](size_t b, size_t e, int) {
+            for (size_t s = b; s < e; s++) {
+                int i = tree.order[s];
+                sortedX[s] = bodies.x[i];
+                sortedY[s] = bodies.y[i];
+                sortedZ[s] = bodies.z[i];
+                sortedM[s] = bodies.mass[i];
+                slotOf[i] = (int)s;
+            }
+        });
+
+        const size_t nodes = tree.nodes.size();
+        cx.resize(nodes); cy.resize(nodes); cz.resize(nodes);
+        radius.assign(nodes, 0.0);
+        multipole.assign(nodes * nterms, 0.0);
+        local.assign(nodes * nterms, 0.0);
+
+        // breadth-first levels, so each pass can go a level at a time in parallel
+        levels.clear();
+        leaves.clear();
+        parent.assign(nodes, -1);
+        std::vector<int> frontier(1, 0);
+        while (!frontier.empty()) {
+            std::vector<int> next;
+            for (int node : frontier) {
+                const OctreeNode& on = tree.nodes[node];
+                if (on.firstChild < 0) {
+                    leaves.push_back(node);
+                    continue;
+                }
+                for (int c = 0; c < 8; c++) {
+                    if (tree.nodes[on.firstChild + c].count > 0) {
+                        next.push_back(on.firstChild + c);
+                        parent[on.firstChild + c] = node;
+                    }
+                }
+            }
+            levels.push_back(std::move(frontier));
+            frontier.swap(next);
+        }
+    }
+
+    void upwardPass(ThreadPool& pool)
+    {
+        for (int level = (int)levels.size() - 1; level >= 0; level--) {
+            const std::vector<int>& cells = levels[level];
+            pool.parallelFor(cells.size(), 16, [&](size_t b, size_t e, int) {
+                std::vector<double> pw(nterms);
+                for (size_t k = b; k < e; k++) {
+                    const int node = cells[k];
+                    const OctreeNode& on = tree.nodes[node];
+                    cx[node] = on.com.x;
+                    cy[node] = on.com.y;
+                    cz[node] = on.com.z;
+                    double* M = &multipole[(size_t)node * nterms];
+                    if (on.firstChild < 0) {
+                        // P2M
+                        double r2 = 0.0;
+                        for (int s = on.begin; s < on.begin + on.count; s++) {
+                            double dx = sortedX[s] - cx[node], dy = sortedY[s] - cy[node], dz = sortedZ[s] - cz[node];
+                            terms.powers(dx, dy, dz, pw.data());
+                            for (int t = 0; t < nterms; t++)
+                                M[t] += sortedM[s] * pw[t];
+                            r2 = std::max(r2, dx * dx + dy * dy + dz * dz);
+                        }
+                        radius[node] = std::sqrt(r2);
+                        continue;
+                    }
+                    // M2M from each child
+                    double r = 0.0;
+                    for (int c = 0; c < 8; c++) {
+                        const int child = on.firstChild + c;
+                        if (tree.nodes[child].count == 0)
+                            continue;
+                        double sx = cx[child] - cx[node], sy = cy[child] - cy[node], sz = cz[child] - cz[node];
+                        terms.powers(sx, sy, sz, pw.data());
+                        const double* Mc = &multipole[(size_t)child * nterms];
+                        for (const FmmTerms::Shift& sh : terms.shifts)
+                            M[sh.k] += sh.coef * Mc[sh.j] * pw[sh.kmj];
+                        r = std::max(r, std::sqrt(sx * sx + sy * sy + sz * sz) + radius[child]);
+                    }
+                    // the cell itself is a tighter bound when the children are lopsided
+                    glm::vec3 off = glm::abs(on.com - on.center) + glm::vec3(on.halfSize);
+                    radius[node] = std::min(r, (double)glm::length(off));
+                }
+            });
+        }
+    }
+
+    bool wellSeparated(int a, int b, float theta) const
+    {
+        double dx = cx[a] - cx[b], dy = cy[a] - cy[b], dz = cz[a] - cz[b];
+        double r = radius[a] + radius[b];
+        return r * r < (double)theta * theta * (dx * dx + dy * dy + dz * dz);
+    }
+
+    void interact(int a, int b, float theta)
+    {
+        if ((double)tree.nodes[a].count * tree.nodes[b].count <= directLimit) {
+            p2pPairs.push_back(std::make_pair(a, b));
+            return;
+        }
+        if (a != b && wellSeparated(a, b, theta)) {
+            m2lPairs.push_back(std::make_pair(a, b));
+            return;
+        }
+        const bool leafA = isLeaf(a), leafB = isLeaf(b);
+        if (leafA && leafB) {
+            p2pPairs.push_back(std::make_pair(a, b));
+            return;
+        }
+        // open the bigger cell, or whichever one can still be opened
+        if (!leafB && (leafA || radius[b] > radius[a])) {
+            const int first = tree.nodes[b].firstChild;
+            for (int c = 0; c < 8; c++) {
+                if (tree.nodes[first + c].count > 0)
+                    interact(a, first + c, theta);
+            }
+        }
+        else {
+            const int first = tree.nodes[a].firstChild;
+            for (int c = 0; c < 8; c++) {
+                if (tree.nodes[first + c].count > 0)
+                    interact(first + c, b, theta);
+            }
+        }
+    }
+
+    // pairs (target, source) bucketed by target
+    static void toRows(const std::vector<std::pair<int, int>>& pairs, size_t nodes,
+                       std::vector<int>& start, std::vector<int>& source)
+    {
+        start.assign(nodes + 1, 0);
+        for (const std::pair<int, int>& p : pairs)
+            start[p.first + 1]++;
+        for (size_t i = 0; i < nodes; i++)
+            start[i + 1] += start[i];
+        source.resize(pairs.size());
+        std::vector<int> cursor(start.begin(), start.end() - 1);
+        for (const std::pair<int, int>& p : pairs)
+            source[cursor[p.first]++] = p.second;
+    }
+
+    void buildInteractionLists(float theta)
+    {
+        m2lPairs.clear();
+        p2pPairs.clear();
+        directLimit = directBias * (double)terms.transfers.size();
+        interact(0, 0, theta);
+        toRows(m2lPairs, tree.nodes.size(), m2lStart, m2lSource);
+        toRows(p2pPairs, tree.nodes.size(), p2pStart, p2pSource);
+        timings.m2lPairs = (long long)m2lPairs.size();
+        timings.p2pPairs = (long long)p2pPairs.size();
+    }
+
+    void transferPass(ThreadPool& pool)
+    {
+        const size_t nodes = tree.nodes.size();
+        pool.parallelFor(nodes, 16, [&](size_t b, size_t e, int) {
+            std::vector<double> T(nterms);
+            for (size_t node = b; node < e; node++) {
+                double* L = &local[node * nterms];
+                for (int k = m2lStart[node]; k < m2lStart[node + 1]; k++) {
+                    const int src = m2lSource[k];
+                    terms.derivatives(cx[node] - cx[src], cy[node] - cy[src], cz[node] - cz[src], SOFTENING, T.data());
+                    const double* M = &multipole[(size_t)src * nterms];
+                    const FmmTerms::Transfer* tr = terms.transfers.data();
+                    for (int t = 0; t < nterms; t++) {
+                        // two partial sums to halve the dependency chain
+                        double sum0 = 0.0, sum1 = 0.0;
+                        int q = terms.transferStart[t];
+                        const int end = terms.transferStart[t + 1];
+                        for (; q + 1 < end; q += 2) {
+                            sum0 += tr[q].coef * M[tr[q].k] * T[tr[q].nk];
+                            sum1 += tr[q + 1].coef * M[tr[q + 1].k] * T[tr[q + 1].nk];
+                        }
+                        if (q < end)
+                            sum0 += tr[q].coef * M[tr[q].k] * T[tr[q].nk];
+                        L[t] += sum0 + sum1;
+                    }
+                }
+            }
+        });
+    }
+
+    void downwardPass(ThreadPool& pool)
+    {
+        for (size_t level = 0; level < levels.size(); level++) {
+            const std::vector<int>& cells = levels[level];
+            pool.parallelFor(cells.size(), 16, [&](size_t b, size_t e, int) {
+                std::vector<double> pw(nterms);
+                for (size_t k = b; k < e; k++) {
+                    const int node = cells[k];
+                    const OctreeNode& on = tree.nodes[node];
+                    if (on.firstChild < 0)
+                        continue;
+                    const double* L = &local[(size_t)node * nterms];
+                    for (int c = 0; c < 8; c++) {
+                        const int child = on.firstChild + c;
+                        if (tree.nodes[child].count == 0)
+                            continue;
+                        terms.powers(cx[child] - cx[node], cy[child] - cy[node], cz[child] - cz[node], pw.data());
+                        double* Lc = &local[(size_t)child * nterms];
+                        for (const FmmTerms::Shift& sh : terms.shifts)
+                            Lc[sh.j] += sh.coef * L[sh.k] * pw[sh.kmj];
+                    }
+                }
+            });
+        }
+    }
+
+    // L2P: adds the pull of a leaf's local expansion to its bodies
+    void localToBodies(int node, float G, double* pw)
+    {
+        const OctreeNode& on = tree.nodes[node];
+        const double* L = &local[(size_t)node * nterms];
+        // a = -grad phi with phi = -G sum_n L_n e^n
+        for (int s = on.begin; s < on.begin + on.count; s++) {
+            terms.powers(sortedX[s] - cx[node], sortedY[s] - cy[node], sortedZ[s] - cz[node], pw);
+            double ax = 0.0, ay = 0.0, az = 0.0;
+            for (int t = 1; t < nterms; t++) {
+                if (terms.less1[0][t] >= 0) ax += terms.kx[t] * L[t] * pw[terms.less1[0][t]];
+                if (terms.less1[1][t] >= 0) ay += terms.ky[t] * L[t] * pw[terms.less1[1][t]];
+                if (terms.less1[2][t] >= 0) az += terms.kz[t] * L[t] * pw[terms.less1[2][t]];
+            }
+            accX[s] += (float)(G * ax);
+            accY[s] += (float)(G * ay);
+            accZ[s] += (float)(G * az);
+        }
+    }
+
+    // L2P and P2P, one leaf at a time. Direct pairs may have been recorded
+    // against any ancestor of the leaf, so its bodies take their share of those.
+    void nearPass(float G, ThreadPool& pool)
+    {
+        const AccelKernel kernel = activeAccelKernel();
+        pool.parallelFor(leaves.size(), 4, [&](size_t b, size_t e, int) {
+            std::vector<double> pw(nterms);
+            for (size_t k = b; k < e; k++) {
+                const int node = leaves[k];
+                const OctreeNode& on = tree.nodes[node];
+                localToBodies(node, G, pw.data());
+                for (int up = node; up >= 0; up = parent[up]) {
+                    for (int p = p2pStart[up]; p < p2pStart[up + 1]; p++) {
+                        const OctreeNode& src = tree.nodes[p2pSource[p]];
+                        kernel(&sortedX[on.begin], &sortedY[on.begin], &sortedZ[on.begin], on.count,
+                               &sortedX[src.begin], &sortedY[src.begin], &sortedZ[src.begin], &sortedM[src.begin], src.count,
+                               G, SOFTENING, &accX[on.begin], &accY[on.begin], &accZ[on.begin]);
+                    }
+                }
+            }
+        });
+    }
+};
+
+// FMM accelerations for everyone, checked body for body against the direct sum
+inline ForceError measureFmmError(const BodySoA& bodies, float G, float theta, int order, ThreadPool& pool, int maxSamples = 1000)
+{
+    BodySoA copy = bodies;
+    FastMultipole fmm;
+    fmm.compute(copy, G, theta, order, pool);
+    return measureForceErrorOf(bodies, G, [&](int i) { return copy.acc(i); }, maxSamples);
+}
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef FORCEKERNEL_H
+#define FORCEKERNEL_H
+
+#include <cmath>
+#include <cstddef>
+#include "cpufeatures.h"
+
+// Direct-summation acceleration kernels. Every variant adds
+//     G * m_j * (r_j - r_i) / (|r_j - r_i|^2 + eps2)^(3/2)
+// over all sources j to target i. The softening sits inside the square root, so
+// a body that appears in both lists pulls on itself with exactly zero force and
+// the loops need no i == j branch. Sources are walked 4/8/16 at a time with an
+// approximate reciprocal square root refined by one Newton step.
+typedef void (*AccelKernel)(const float* tx, const float* ty, const float* tz, size_t nt,
+                            const float* sx, const float* sy, const float* sz, const float* sm, size_t ns,
+                            float G, float eps2, float* ax, float* ay, float* az);
+
+inline void accelKernelScalar(const float* tx, const float* ty, const float* tz, size_t nt,
+                              const float* sx, const float* sy, const float* sz, const float* sm, size_t ns,
+                              float G, float eps2, float* ax, float* ay, float* az)
+{
+    for (size_t i = 0; i < nt; i++) {
+        const float xi = tx[i], yi = ty[i], zi = tz[i];
+        float axi = 0.0f, ayi = 0.0f, azi = 0.0f;
+        for (size_t j = 0; j < ns; j++) {
+            float dx = sx[j] - xi, dy = sy[j] - yi, dz = sz[j] - zi;
+            float r2 = dx * dx + dy * dy + dz * dz + eps2;
+            float inv = 1.0f / std::sqrt(r2);
+            float s = sm[j] * inv * inv * inv;
+            axi += s * dx;
+            ayi += s * dy;
+            azi += s * dz;
+        }
+        ax[i] += G * axi;
+        ay[i] += G * ayi;
+        az[i] += G * azi;
+    }
+}
+
+// Newton's-third-law variant. A block of up to PAIR_BLOCK consecutive bodies
+// i0 .. i0+ni-1 meets every j in [j0, j1) once (all j past the block), and
+// each pull is added to the i side and subtracted from the j side, scaled by
+// the other body's mass. Loading a j once for a whole block of rows keeps the
+// j-side read-modify-write from dominating. G is left out so callers can apply
+// it once after summing partial buffers.
+const int PAIR_BLOCK = 4;
+
+typedef void (*PairBlockKernel)(const float* x, const float* y, const float* z, const float* m,
+                                size_t i0, size_t ni, size_t j0, size_t j1, float eps2,
+                                float* ax, float* ay, float* az);
+
+inline void pairBlockKernelScalar(const float* x, const float* y, const float* z, const float* m,
+                                  size_t i0, size_t ni, size_t j0, size_t j1, float eps2,
+                                  float* ax, float* ay, float* az)
+{
+    for (size_t i = i0; i < i0 + ni; i++) {
+        const float xi = x[i], yi = y[i], zi = z[i], mi = m[i];
+        float axi = 0.0f, ayi = 0.0f, azi = 0.0f;
+        for (size_t j = j0; j < j1; j++) {
+            float dx = x[j] - xi, dy = y[j] - yi, dz = z[j] - zi;
+            float r2 = dx * dx + dy * dy + dz * dz + eps2;
+            float inv = 1.0f / std::sqrt(r2);
+            float s = inv * inv * inv;
+            float sj = m[j] * s, si = mi * s;
+            axi += sj * dx; ayi += sj * dy; azi += sj * dz;
+            ax[j] -= si * dx; ay[j] -= si * dy; az[j] -= si * dz;
+        }
+        ax[i] += axi;
+        ay[i] += ayi;
+        az[i] += azi;
+    }
+}
+
+#ifdef ORBO_X86
+
+inline float hsum128(__m128 v)
+{
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+inline void accelKernelSSE(const float* tx, const float* ty, const float* tz, size_t nt,
+                           const float* sx, const float* sy, const float* sz, const float* sm, size_t ns,
+                           float G, float eps2, float* ax, float* ay, float* az)
+{
+    const size_t nv = ns & ~(size_t)3;
+    const __m128 vEps = _mm_set1_ps(eps2);
+    const __m128 vHalf = _mm_set1_ps(0.5f);
+    const __m128 vThreeHalf = _mm_set1_ps(1.5f);
+    for (size_t i = 0; i < nt; i++) {
+        const __m128 xi = _mm_set1_ps(tx[i]), yi = _mm_set1_ps(ty[i]), zi = _mm_set1_ps(tz[i]);
+        __m128 accX = _mm_setzero_ps(), accY = _mm_setzero_ps(), accZ = _mm_setzero_ps();
+        for (size_t j = 0; j < nv; j += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(sx + j), xi);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(sy + j), yi);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(sz + j), zi);
+            __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_add_ps(_mm_mul_ps(dz, dz), vEps));
+            __m128 inv = _mm_rsqrt_ps(r2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(vThreeHalf, _mm_mul_ps(_mm_mul_ps(vHalf, r2), _mm_mul_ps(inv, inv))));
+            __m128 s = _mm_mul_ps(_mm_loadu_ps(sm + j), _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+            accX = _mm_add_ps(accX, _mm_mul_ps(s, dx));
+            accY = _mm_add_ps(accY, _mm_mul_ps(s, dy));
+            accZ = _mm_add_ps(accZ, _mm_mul_ps(s, dz));
+        }
+        float axi = hsum128(accX), ayi = hsum128(accY), azi = hsum128(accZ);
+        for (size_t j = nv; j < ns; j++) {
+            float dx = sx[j] - tx[i], dy = sy[j] - ty[i], dz = sz[j] - tz[i];
+            float r2 = dx * dx + dy * dy + dz * dz + eps2;
+            float inv = 1.0f / std::sqrt(r2);
+            float s = sm[j] * inv * inv * inv;
+            axi += s * dx;
+            ayi += s * dy;
+            azi += s * dz;
+        }
+        ax[i] += G * axi;
+        ay[i] += G * ayi;
+        az[i] += G * azi;
+    }
+}
+
+ORBO_TARGET("avx2,fma")
+inline float hsum256(__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    return hsum128(_mm_add_ps(lo, hi));
+}
+
+ORBO_TARGET("avx2,fma")
+inline void accelKernelAVX2(const float* tx, const float* ty, const float* tz, size_t nt,
+                            const float* sx, const float* sy, const float* sz, const float* sm, size_t ns,
+                            float G, float eps2, float* ax, float* ay, float* az)
+{
+    const size_t nv = ns & ~(size_t)7;
+    const size_t rest = ns - nv;
+    // lanes past the end of the sources load as zero mass and add nothing
+    const __m256i tailMask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)rest), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256 vEps = _mm256_set1_ps(eps2);
+    const __m256 vHalf = _mm256_set1_ps(0.5f);
+    const __m256 vThreeHalf = _mm256_set1_ps(1.5f);
+
+    for (size_t i = 0; i < nt; i++) {
+        const __m256 xi = _mm256_set1_ps(tx[i]), yi = _mm256_set1_ps(ty[i]), zi = _mm256_set1_ps(tz[i]);
+        __m256 accX = _mm256_setzero_ps(), accY = _mm256_setzero_ps(), accZ = _mm256_setzero_ps();
+        for (size_t j = 0; j < ns; j += 8) {
+            __m256 px, py, pz, m;
+            if (j < nv) {
+                px = _mm256_loadu_ps(sx + j);
+                py = _mm256_loadu_ps(sy + j);
+                pz = _mm256_loadu_ps(sz + j);
+                m = _mm256_loadu_ps(sm + j);
+            }
+            else {
+                px = _mm256_maskload_ps(sx + j, tailMask);
+                py = _mm256_maskload_ps(sy + j, tailMask);
+                pz = _mm256_maskload_ps(sz + j, tailMask);
+                m = _mm256_maskload_ps(sm + j, tailMask);
+            }
+            __m256 dx = _mm256_sub_ps(px, xi);
+            __m256 dy = _mm256_sub_ps(py, yi);
+            __m256 dz = _mm256_sub_ps(pz, zi);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, vEps)));
+            __m256 inv = _mm256_rsqrt_ps(r2);
+            inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(vHalf, r2), _mm256_mul_ps(inv, inv), vThreeHalf));
+            __m256 s = _mm256_mul_ps(m, _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+            accX = _mm256_fmadd_ps(s, dx, accX);
+            accY = _mm256_fmadd_ps(s, dy, accY);
+            accZ = _mm256_fmadd_ps(s, dz, accZ);
+        }
+        ax[i] += G * hsum256(accX);
+        ay[i] += G * hsum256(accY);
+        az[i] += G * hsum256(accZ);
+    }
+}
+
+ORBO_TARGET("avx512f")
+inline void accelKernelAVX512(const float* tx, const float* ty, const float* tz, size_t nt,
+                              const float* sx, const float* sy, const float* sz, const float* sm, size_t ns,
+                              float G, float eps2, float* ax, float* ay, float* az)
+{
+    const size_t nv = ns & ~(size_t)15;
+    const __mmask16 tailMask = (__mmask16)((1u << (ns - nv)) - 1u);
+    const __m512 vEps = _mm512_set1_ps(eps2);
+    const __m512 vHalf = _mm512_set1_ps(0.5f);
+    const __m512 vThreeHalf = _mm512_set1_ps(1.5f);
+
+    for (size_t i = 0; i < nt; i++) {
+        const __m512 xi = _mm512_set1_ps(tx[i]), yi = _mm512_set1_ps(ty[i]), zi = _mm512_set1_ps(tz[i]);
+        __m512 accX = _mm512_setzero_ps(), accY = _mm512_setzero_ps(), accZ = _mm512_setzero_ps();
+        for (size_t j = 0; j < ns; j += 16) {
+            const __mmask16 k = j < nv ? (__mmask16)0xFFFF : tailMask;
+            __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(k, sx + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(k, sy + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(k, sz + j), zi);
+            __m512 m = _mm512_maskz_loadu_ps(k, sm + j);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, vEps)));
+            __m512 inv = _mm512_rsqrt14_ps(r2);
+            inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(vHalf, r2), _mm512_mul_ps(inv, inv), vThreeHalf));
+            __m512 s = _mm512_mul_ps(m, _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv)));
+            accX = _mm512_fmadd_ps(s, dx, accX);
+            accY = _mm512_fmadd_ps(s, dy, accY);
+            accZ = _mm512_fmadd_ps(s, dz, accZ);
+        }
+        ax[i] += G * _mm512_reduce_add_ps(accX);
+        ay[i] += G * _mm512_reduce_add_ps(accY);
+        az[i] += G * _mm512_reduce_add_ps(accZ);
+    }
+}
+
+
+// Rows past ni are padded with a copy of row i0 carrying zero mass, so they
+// push nothing onto j and whatever they collect is thrown away.
+#define ORBO_PAIR_ROWS(setps, T)                                            \
+    T xi[PAIR_BLOCK], yi[PAIR_BLOCK], zi[PAIR_BLOCK], mi[PAIR_BLOCK];       \
+    for (int r = 0; r < PAIR_BLOCK; r++) {                                  \
+        size_t i = r < (int)ni ? i0 + r : i0;                               \
+        xi[r] = setps(x[i]); yi[r] = setps(y[i]); zi[r] = setps(z[i]);      \
+        mi[r] = setps(r < (int)ni ? m[i] : 0.0f);                           \
+    }
+
+inline void pairBlockKernelSSE(const float* x, const float* y, const float* z, const float* m,
+                               size_t i0, size_t ni, size_t j0, size_t j1, float eps2,
+                               float* ax, float* ay, float* az)
+{
+    ORBO_PAIR_ROWS(_mm_set1_ps, __m128)
+    const __m128 vEps = _mm_set1_ps(eps2);
+    const __m128 vHalf = _mm_set1_ps(0.5f);
+    const __m128 vThreeHalf = _mm_set1_ps(1.5f);
+    __m128 accX[PAIR_BLOCK], accY[PAIR_BLOCK], accZ[PAIR_BLOCK];
+    for (int r = 0; r < PAIR_BLOCK; r++)
+        accX[r] = accY[r] = accZ[r] = _mm_setzero_ps();
+
+    size_t j = j0;
+    for (; j + 4 <= j1; j += 4) {
+        const __m128 xj = _mm_loadu_ps(x + j), yj = _mm_loadu_ps(y + j), zj = _mm_loadu_ps(z + j), mj = _mm_loadu_ps(m + j);
+        __m128 fx = _mm_loadu_ps(ax + j), fy = _mm_loadu_ps(ay + j), fz = _mm_loadu_ps(az + j);
+        for (int r = 0; r < PAIR_BLOCK; r++) {
+            __m128 dx = _mm_sub_ps(xj, xi[r]);
+            __m128 dy = _mm_sub_ps(yj, yi[r]);
+            __m128 dz = _mm_sub_ps(zj, zi[r]);
+            __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_add_ps(_mm_mul_ps(dz, dz), vEps));
+            __m128 inv = _mm_rsqrt_ps(r2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(vThreeHalf, _mm_mul_ps(_mm_mul_ps(vHalf, r2), _mm_mul_ps(inv, inv))));
+            __m128 s = _mm_mul_ps(inv, _mm_mul_ps(inv, inv));
+            __m128 sj = _mm_mul_ps(mj, s), si = _mm_mul_ps(mi[r], s);
+            accX[r] = _mm_add_ps(accX[r], _mm_mul_ps(sj, dx));
+            accY[r] = _mm_add_ps(accY[r], _mm_mul_ps(sj, dy));
+            accZ[r] = _mm_add_ps(accZ[r], _mm_mul_ps(sj, dz));
+            fx = _mm_sub_ps(fx, _mm_mul_ps(si, dx));
+            fy = _mm_sub_ps(fy, _mm_mul_ps(si, dy));
+            fz = _mm_sub_ps(fz, _mm_mul_ps(si, dz));
+        }
+        _mm_storeu_ps(ax + j, fx);
+        _mm_storeu_ps(ay + j, fy);
+        _mm_storeu_ps(az + j, fz);
+    }
+    for (size_t r = 0; r < ni; r++) {
+        ax[i0 + r] += hsum128(accX[r]);
+        ay[i0 + r] += hsum128(accY[r]);
+        az[i0 + r] += hsum128(accZ[r]);
+    }
+    if (j < j1)
+        pairBlockKernelScalar(x, y, z, m, i0, ni, j, j1, eps2, ax, ay, az);
+}
+
+ORBO_TARGET("avx2,fma")
+inline void pairBlockKernelAVX2(const float* x, const float* y, const float* z, const float* m,
+                                size_t i0, size_t ni, size_t j0, size_t j1, float eps2,
+                                float* ax, float* ay, float* az)
+{
+    ORBO_PAIR_ROWS(_mm256_set1_ps, __m256)
+    const __m256 vEps = _mm256_set1_ps(eps2);
+    const __m256 vHalf = _mm256_set1_ps(0.5f);
+    const __m256 vThreeHalf = _mm256_set1_ps(1.5f);
+    __m256 accX[PAIR_BLOCK], accY[PAIR_BLOCK], accZ[PAIR_BLOCK];
+    for (int r = 0; r < PAIR_BLOCK; r++)
+        accX[r] = accY[r] = accZ[r] = _mm256_setzero_ps();
+
+    size_t j = j0;
+    for (; j + 8 <= j1; j += 8) {
+        const __m256 xj = _mm256_loadu_ps(x + j), yj = _mm256_loadu_ps(y + j), zj = _mm256_loadu_ps(z + j), mj = _mm256_loadu_ps(m + j);
+        __m256 fx = _mm256_loadu_ps(ax + j), fy = _mm256_loadu_ps(ay + j), fz = _mm256_loadu_ps(az + j);
+        for (int r = 0; r < PAIR_BLOCK; r++) {
+            __m256 dx = _mm256_sub_ps(xj, xi[r]);
+            __m256 dy = _mm256_sub_ps(yj, yi[r]);
+            __m256 dz = _mm256_sub_ps(zj, zi[r]);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, vEps)));
+            __m256 inv = _mm256_rsqrt_ps(r2);
+            inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(vHalf, r2), _mm256_mul_ps(inv, inv), vThreeHalf));
+            __m256 s = _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv));
+            __m256 sj = _mm256_mul_ps(mj, s), si = _mm256_mul_ps(mi[r], s);
+            accX[r] = _mm256_fmadd_ps(sj, dx, accX[r]);
+            accY[r] = _mm256_fmadd_ps(sj, dy, accY[r]);
+            accZ[r] = _mm256_fmadd_ps(sj, dz, accZ[r]);
+            fx = _mm256_fnmadd_ps(si, dx, fx);
+            fy = _mm256_fnmadd_ps(si, dy, fy);
+            fz = _mm256_fnmadd_ps(si, dz, fz);
+        }
+        _mm256_storeu_ps(ax + j, fx);
+        _mm256_storeu_ps(ay + j, fy);
+        _mm256_storeu_ps(az + j, fz);
+    }
+    for (size_t r = 0; r < ni; r++) {
+        ax[i0 + r] += hsum256(accX[r]);
+        ay[i0 + r] += hsum256(accY[r]);
+        az[i0 + r] += hsum256(accZ[r]);
+    }
+    if (j < j1)
+        pairBlockKernelScalar(x, y, z, m, i0, ni, j, j1, eps2, ax, ay, az);
+}
+
+ORBO_TARGET("avx512f")
+inline void pairBlockKernelAVX512(const float* x, const float* y, const float* z, const float* m,
+                                  size_t i0, size_t ni, size_t j0, size_t j1, float eps2,
+                                  float* ax, float* ay, float* az)
+{
+    ORBO_PAIR_ROWS(_mm512_set1_ps, __m512)
+    const __m512 vEps = _mm512_set1_ps(eps2);
+    const __m512 vHalf = _mm512_set1_ps(0.5f);
+    const __m512 vThreeHalf = _mm512_set1_ps(1.5f);
+    const __mmask16 tailMask = (__mmask16)((1u << ((j1 - j0) & 15)) - 1u);
+    __m512 accX[PAIR_BLOCK], accY[PAIR_BLOCK], accZ[PAIR_BLOCK];
+    for (int r = 0; r < PAIR_BLOCK; r++)
+        accX[r] = accY[r] = accZ[r] = _mm512_setzero_ps();
+
+    for (size_t j = j0; j < j1; j += 16) {
+        // masked-off lanes load zero mass and are not written back
+        const __mmask16 k = j + 16 <= j1 ? (__mmask16)0xFFFF : tailMask;
+        const __m512 xj = _mm512_maskz_loadu_ps(k, x + j), yj = _mm512_maskz_loadu_ps(k, y + j);
+        const __m512 zj = _mm512_maskz_loadu_ps(k, z + j), mj = _mm512_maskz_loadu_ps(k, m + j);
+        __m512 fx = _mm512_maskz_loadu_ps(k, ax + j), fy = _mm512_maskz_loadu_ps(k, ay + j), fz = _mm512_maskz_loadu_ps(k, az + j);
+        for (int r = 0; r < PAIR_BLOCK; r++) {
+            __m512 dx = _mm512_sub_ps(xj, xi[r]);
+            __m512 dy = _mm512_sub_ps(yj, yi[r]);
+            __m512 dz = _mm512_sub_ps(zj, zi[r]);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, vEps)));
+            __m512 inv = _mm512_rsqrt14_ps(r2);
+            inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(vHalf, r2), _mm512_mul_ps(inv, inv), vThreeHalf));
+            __m512 s = _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv));
+            __m512 sj = _mm512_mul_ps(mj, s), si = _mm512_mul_ps(mi[r], s);
+            accX[r] = _mm512_fmadd_ps(sj, dx, accX[r]);
+            accY[r] = _mm512_fmadd_ps(sj, dy, accY[r]);
+            accZ[r] = _mm512_fmadd_ps(sj, dz, accZ[r]);
+            fx = _mm512_fnmadd_ps(si, dx, fx);
+            fy = _mm512_fnmadd_ps(si, dy, fy);
+            fz = _mm512_fnmadd_ps(si, dz, fz);
+        }
+        _mm512_mask_storeu_ps(ax + j, k, fx);
+        _mm512_mask_storeu_ps(ay + j, k, fy);
+        _mm512_mask_storeu_ps(az + j, k, fz);
+    }
+    for (size_t r = 0; r < ni; r++) {
+        ax[i0 + r] += _mm512_reduce_add_ps(accX[r]);
+        ay[i0 + r] += _mm512_reduce_add_ps(accY[r]);
+        az[i0 + r] += _mm512_reduce_add_ps(accZ[r]);
+    }
+}
+
+#undef ORBO_PAIR_ROWS
+
+#endif
+
+inline AccelKernel accelKernelFor(SimdLevel level)
+{
+#ifdef ORBO_X86
+    switch (level) {
+    case SIMD_AVX512: return accelKernelAVX512;
+    case SIMD_AVX2: return accelKernelAVX2;
+    case SIMD_SSE: return accelKernelSSE;
+    default: break;
+    }
+#endif
+    return accelKernelScalar;
+}
+
+inline PairBlockKernel pairBlockKernelFor(SimdLevel level)
+{
+#ifdef ORBO_X86
+    switch (level) {
+    case SIMD_AVX512: return pairBlockKernelAVX512;
+    case SIMD_AVX2: return pairBlockKernelAVX2;
+    case SIMD_SSE: return pairBlockKernelSSE;
+    default: break;
+    }
+#endif
+    return pairBlockKernelScalar;
+}
+
+// Chosen once at startup from CPUID; setSimdLevel can force a lower level
+// (e.g. to compare variants), but never one the CPU doesn't have.
+inline SimdLevel& activeSimdLevel()
+{
+    static SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+inline AccelKernel& activeAccelKernel()
+{
+    static AccelKernel kernel = accelKernelFor(activeSimdLevel());
+    return kernel;
+}
+
+inline PairBlockKernel& activePairBlockKernel()
+{
+    static PairBlockKernel kernel = pairBlockKernelFor(activeSimdLevel());
+    return kernel;
+}
+
+inline void setSimdLevel(SimdLevel level)
+{
+    SimdLevel best = detectSimdLevel();
+    if (level > best)
+        level = best;
+    activeSimdLevel() = level;
+    activeAccelKernel() = accelKernelFor(level);
+    activePairBlockKernel() = pairBlockKernelFor(level);
+}
+
+#endif
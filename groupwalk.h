@@ -0,0 +1,264 @@
+#ifndef GROUPWALK_H
+#define GROUPWALK_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "body.h"
+#include "directsum.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+#include "barneshut.h"
+
+struct GroupWalkStats {
+    long long groups = 0;
+    long long cells = 0;       // accepted cells, summed over groups
+    long long particles = 0;   // bodies from opened leaves, summed over groups
+};
+
+// Barnes-Hut with one walk per group of nearby bodies instead of one per
+// body. A group is the largest octree node holding at most groupSize bodies.
+// Its walk tests cells against the group's whole cube, so whatever it accepts
+// is far enough from every body in it, and it comes back with two lists: the
+// accepted cells and the bodies of the leaves it had to open (the group's own
+// included; softening makes a body's pull on itself zero). Both lists are
+// then summed over the group's bodies with the SIMD direct-sum kernel, which
+// is where all the arithmetic happens. The criterion is a little stricter
+// than the per-body walk's at the same theta, as the distance is measured to
+// the nearest point of the group. With quadrupoles the cells go through the
+// scalar cell evaluation instead, and only the bodies use the kernel.
+class GroupWalk
+{
+public:
+    int groupSize = 32;
+    GroupWalkStats stats;
+
+    // accelerations for every body, or only for the listed ones; the tree must
+    // already be built or refitted for the current positions
+    void compute(const Octree& tree, BodySoA& bodies, float G, float theta, ThreadPool& pool,
+                 const std::vector<int>* active = nullptr)
+    {
+        stats = GroupWalkStats();
+        if (tree.nodes.empty())
+            return;
+        collectGroups(tree);
+
+        if (active) {
+            isActive.assign(bodies.size(), 0);
+            for (int i : *active)
+                isActive[i] = 1;
+        }
+        if ((int)scratch.size() < pool.size())
+            scratch.resize(pool.size());
+        std::vector<GroupWalkStats> partial(pool.size());
+        const AccelKernel kernel = activeAccelKernel();
+        const bool quad = tree.hasQuadrupoles();
+        const float theta2 = theta * theta;
+
+        pool.parallelFor(groups.size(), 1, [&](size_t b, size_t e, int worker) {
+            Scratch& s = scratch[worker];
+            for (size_t g = b; g < e; g++) {
+                const OctreeNode& group = tree.nodes[groups[g]];
+
+                // targets, in tree order
+                s.targets.clear();
+                for (int k = group.begin; k < group.begin + group.count; k++) {
+                    const int i = tree.order[k];
+                    if (!active || isActive[i])
+                        s.targets.push_back(i);
+                }
+                const size_t nt = s.targets.size();
+                if (nt == 0)
+                    continue;
+
+                walk(tree, bodies, group.center - glm::vec3(group.halfSize), group.center + glm::vec3(group.halfSize),
+                     theta2, quad, s);
+                partial[worker].groups++;
+                partial[worker].cells += (long long)s.cells.size();
+                // without quadrupoles the accepted cells ride at the end of sx
+                partial[worker].particles += (long long)(s.sx.size() - (quad ? 0 : s.cells.size()));
+
+                s.tx.resize(nt); s.ty.resize(nt); s.tz.resize(nt);
+                s.ax.assign(nt, 0.0f); s.ay.assign(nt, 0.0f); s.az.assign(nt, 0.0f);
+                for (size_t t = 0; t < nt; t++) {
+                    const int i = s.targets[t];
+                    s.tx[t] = bodies.x[i];
+                    s.ty[t] = bodies.y[i];
+                    s.tz[t] = bodies.z[i];
+                }
+                kernel(s.tx.data(), s.ty.data(), s.tz.data(), nt,
+                       s.sx.data(), s.sy.data(), s.sz.data(), s.sm.data(), s.sx.size(),
+                       G, SOFTENING, s.ax.data(), s.ay.data(), s.az.data());
+                for (size_t t = 0; t < nt; t++) {
+                    const int i = s.targets[t];
+                    glm::vec3 a(s.ax[t], s.ay[t], s.az[t]);
+                    if (quad) {
+                        const glm::vec3 p(s.tx[t], s.ty[t], s.tz[t]);
+                        for (int c : s.cells)
+                            a += tree.cellAccel(p, tree.nodes[c], G);
+                    }
+                    bodies.ax[i] = a.x;
+                    bodies.ay[i] = a.y;
+                    bodies.az[i] = a.z;
+                }
+            }
+        });
+
+        for (const GroupWalkStats& p : partial) {
+            stats.groups += p.groups;
+            stats.cells += p.cells;
+            stats.particles += p.particles;
+        }
+    }
+
+    // Accelerations on points that aren't in the tree (massless tracers) from
+    // the bodies that are. The targets are taken in runs of groupSize in the
+    // order they're stored, so they should be sorted along a space-filling
+    // curve for the runs to be compact; each run is walked against its
+    // bounding box. Quadrupoles are left out here.
+    void computeAt(const Octree& tree, const BodySoA& sources, BodySoA& targets, float G, float theta, ThreadPool& pool)
+    {
+        stats = GroupWalkStats();
+        targets.zeroAcc();
+        if (tree.nodes.empty() || targets.empty())
+            return;
+        if ((int)scratch.size() < pool.size())
+            scratch.resize(pool.size());
+        std::vector<GroupWalkStats> partial(pool.size());
+        const AccelKernel kernel = activeAccelKernel();
+        const float theta2 = theta * theta;
+        const size_t size = (size_t)std::max(1, groupSize);
+        const size_t runs = (targets.size() + size - 1) / size;
+
+        pool.parallelFor(runs, 1, [&](size_t b, size_t e, int worker) {
+            Scratch& s = scratch[worker];
+            for (size_t r = b; r < e; r++) {
+                const size_t first = r * size;
+                const size_t nt = std::min(size, targets.size() - first);
+                glm::vec3 lo = targets.pos(first), hi = lo;
+                for (size_t t = first + 1; t < first + nt; t++) {
+                    lo = glm::min(lo, targets.pos(t));
+                    hi = glm::max(hi, targets.pos(t));
+                }
+                walk(tree, sources, lo, hi, theta2, false, s);
+                partial[worker].groups++;
+                partial[worker].cells += (long long)s.cells.size();
+                partial[worker].particles += (long long)(s.sx.size() - s.cells.size());
+                kernel(&targets.x[first], &targets.y[first], &targets.z[first], nt,
+                       s.sx.data(), s.sy.data(), s.sz.data(), s.sm.data(), s.sx.size(),
+                       G, SOFTENING, &targets.ax[first], &targets.ay[first], &targets.az[first]);
+            }
+        });
+
+        for (const GroupWalkStats& p : partial) {
+            stats.groups += p.groups;
+            stats.cells += p.cells;
+            stats.particles += p.particles;
+        }
+    }
+
+private:
+    struct Scratch {
+        std::vector<int> targets, cells;
+        AlignedVector<float> sx, sy, sz, sm;   // interaction list: bodies, then monopole cells
+        AlignedVector<float> tx, ty, tz, ax, ay, az;
+        std::vector<int> stack;
+    };
+    std::vector<Scratch> scratch;
+    std::vector<int> groups;
+    std::vector<char> isActive;
+
+    // largest nodes with at most groupSize bodies, plus any leaf bigger than
+    // that (a leaf can't be split further)
+    void collectGroups(const Octree& tree)
+    {
+        groups.clear();
+        std::vector<int> stack(1, 0);
+        while (!stack.empty()) {
+            const int n = stack.back();
+            stack.pop_back();
+            const OctreeNode& node = tree.nodes[n];
+            if (node.count == 0)
+                continue;
+            if (node.count <= groupSize || node.firstChild < 0) {
+                groups.push_back(n);
+                continue;
+            }
+            for (int c = 7; c >= 0; c--)
+                stack.push_back(node.firstChild + c);
+        }
+    }
+
+    // interaction list for the targets inside the box lo..hi
+    void walk(const Octree& tree, const BodySoA& bodies, const glm::vec3& lo, const glm::vec3& hi, float theta2, bool quad,
+              Scratch& s) const
+    {
+        s.cells.clear();
+        s.sx.clear(); s.sy.clear(); s.sz.clear(); s.sm.clear();
+
+        s.stack.clear();
+        s.stack.push_back(0);
+        while (!s.stack.empty()) {
+            const int n = s.stack.back();
+            s.stack.pop_back();
+            const OctreeNode& node = tree.nodes[n];
+            if (node.count == 0)
+                continue;
+
+            if (node.firstChild < 0) {
+                for (int k = node.begin; k < node.begin + node.count; k++) {
+                    const int j = tree.order[k];
+                    s.sx.push_back(bodies.x[j]);
+                    s.sy.push_back(bodies.y[j]);
+                    s.sz.push_back(bodies.z[j]);
+                    s.sm.push_back(bodies.mass[j]);
+                }
+                continue;
+            }
+
+            // distance from the cell's com to the nearest point of the group;
+            // a cell overlapping the group (an ancestor, say) is always opened,
+            // as the per-body walk does for a cell containing its body
+            const glm::vec3 gap = glm::max(glm::max(lo - node.com, node.com - hi), glm::vec3(0.0f));
+            const float dist2 = glm::dot(gap, gap);
+            const float size = 2.0f * node.halfSize;
+            const glm::vec3 nodeLo = node.center - glm::vec3(node.halfSize);
+            const glm::vec3 nodeHi = node.center + glm::vec3(node.halfSize);
+            const bool overlaps = glm::all(glm::lessThanEqual(nodeLo, hi)) && glm::all(glm::lessThanEqual(lo, nodeHi));
+            if (!overlaps && size * size < theta2 * dist2) {
+                s.cells.push_back(n);
+                continue;
+            }
+            for (int c = 7; c >= 0; c--)
+                s.stack.push_back(node.firstChild + c);
+        }
+
+        // monopole cells ride along at the end of the body list
+        if (!quad) {
+            for (int c : s.cells) {
+                const OctreeNode& node = tree.nodes[c];
+                s.sx.push_back(node.com.x);
+                s.sy.push_back(node.com.y);
+                s.sz.push_back(node.com.z);
+                s.sm.push_back(node.mass);
+            }
+        }
+    }
+};
+
+// group walk accelerations for everyone, checked body for body against the direct sum
+inline ForceError measureGroupWalkError(const BodySoA& bodies, float G, float theta, bool quadrupole, int groupSize,
+                                        ThreadPool& pool, int maxSamples = 1000)
+{
+    BodySoA copy = bodies;
+    Octree tree;
+    tree.quadrupole = quadrupole;
+    tree.update(copy, pool);
+    GroupWalk walk;
+    walk.groupSize = groupSize;
+    walk.compute(tree, copy, G, theta, pool);
+    return measureForceErrorOf(bodies, G, [&](int i) { return copy.acc(i); }, maxSamples);
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include "body.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+#include "initialconditions.h"
+#include "directsum.h"
+#include "physics.h"
+#include "simulation.h"
+
+struct HeadlessOptions {
+    int bodies = 1000;
+    long long steps = 1000;
+    float dt = 1.0f / 60.0f;
+    int solver = SOLVER_DIRECT;
+    float theta = 0.5f;
+    int fmmOrder = 4;
+    int pmGrid = 64;
+    float treepmSplit = 1.5f;
+    int sortInterval = 16;  // steps between Morton reorders, 0 for never
+    bool treeRefit = true;
+    bool treeQuadrupole = false;
+    int treeGroupSize = 64;  // bodies per Barnes-Hut group walk, 0 for one walk per body
+    float G = 1.0f;
+    int integrator = INTEGRATOR_LEAPFROG;
+    int scene = SCENE_CUBE;
+    int tracers = 0;      // massless tracers added to the scene
+    unsigned int seed = 1234;
+    std::string output;   // final state as CSV, skipped if empty
+    bool energy = false;  // O(N^2) energy check before and after
+};
+
+// x,y,z,vx,vy,vz,mass per line: the massive bodies in id order whatever order
+// the arrays are in, then the massless tracers in id order (mass 0)
+inline bool writeStateCsv(const BodySoA& bodies, const BodySoA& tracers, const std::string& path)
+{
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    std::fprintf(f, "x,y,z,vx,vy,vz,mass\n");
+    for (const BodySoA* set : { &bodies, &tracers }) {
+        std::vector<size_t> slot(set->size());
+        for (size_t i = 0; i < set->size(); i++)
+            slot[set->id[i]] = i;
+        for (size_t i : slot) {
+            std::fprintf(f, "%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", set->x[i], set->y[i], set->z[i],
+                set->vx[i], set->vy[i], set->vz[i], set->mass[i]);
+        }
+    }
+    return std::fclose(f) == 0;
+}
+
+// Steps the simulation as fast as it will go with no window, GL context or
+// frame pacing, printing progress and throughput. Interactions are counted as
+// body pairs a direct sum would have evaluated (targets x sources), so the
+// figure is comparable across solvers. Returns a process exit code.
+inline int runHeadless(const HeadlessOptions& opt, ThreadPool& pool)
+{
+    BodySoA initial = makeScene(opt.scene, opt.bodies, opt.seed, opt.G);
+    addTracers(initial, opt.scene, opt.tracers, opt.seed + 1, opt.G);
+    Simulation sim(std::move(initial), pool);
+    sim.dt = opt.dt;
+    sim.gravity.settings.G = opt.G;
+    sim.gravity.settings.solver = opt.solver;
+    sim.gravity.settings.theta = opt.theta;
+    sim.gravity.settings.fmmOrder = opt.fmmOrder;
+    sim.gravity.settings.pmGrid = opt.pmGrid;
+    sim.gravity.settings.treepmSplit = opt.treepmSplit;
+    sim.sortInterval = opt.sortInterval;
+    sim.gravity.settings.treeRefit = opt.treeRefit;
+    sim.gravity.settings.treeQuadrupole = opt.treeQuadrupole;
+    sim.gravity.settings.treeGroupSize = opt.treeGroupSize;
+    sim.setIntegrator(opt.integrator);
+
+    std::printf("Headless: %s, %d bodies, %lld steps of %g, %s, %s, %s kernel, %d threads\n",
+        sceneNames[opt.scene], opt.bodies, opt.steps, opt.dt, solverNames[opt.solver], integratorNames[opt.integrator],
+        simdLevelNames[activeSimdLevel()], pool.size());
+    if (opt.tracers > 0)
+        std::printf("  plus %d massless tracers\n", opt.tracers);
+
+    double e0 = 0.0;
+    glm::dvec3 p0(0.0);
+    if (opt.energy) {
+        e0 = totalEnergy(sim.bodies, opt.G, pool);
+        p0 = totalMomentum(sim.bodies);
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    const long long reportEvery = std::max(1LL, opt.steps / 10);
+    const Clock::time_point start = Clock::now();
+    for (long long s = 1; s <= opt.steps; s++) {
+        sim.step();
+        if (s % reportEvery == 0 || s == opt.steps) {
+            double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            std::printf("  step %lld/%lld  t = %.3f  %.2f s  %.2f ms/step\n",
+                s, opt.steps, sim.time, elapsed, 1e3 * elapsed / s);
+            std::fflush(stdout);
+        }
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (opt.sortInterval > 0)
+        std::printf("Morton reorder every %d steps, last one %.2f ms (keys %.2f, sort %.2f, gather %.2f)\n",
+            opt.sortInterval, sim.sorter.lastMs, sim.sorter.keysMs, sim.sorter.sortMs, sim.sorter.gatherMs);
+
+    const double interactions = (double)sim.targetEvals * (double)sim.bodies.size();
+    std::printf("%lld force evaluations in %.3f s: %.3f G interactions/s\n",
+        sim.targetEvals, elapsed, elapsed > 0.0 ? interactions / elapsed * 1e-9 : 0.0);
+    if (PatchedConics* conics = dynamic_cast<PatchedConics*>(sim.integratorImpl()))
+        std::printf("%lld sphere-of-influence crossings\n", conics->totalTransitions);
+    if (!sim.tracers.empty())
+        std::printf("%lld tracer force evaluations, each against the %zu massive bodies only\n",
+            sim.tracerEvals, sim.bodies.size());
+
+    if (opt.solver == SOLVER_FMM) {
+        const FmmTimings& t = sim.gravity.fmmTimings();
+        std::printf("last FMM evaluation (order %d): %.2f ms = build %.2f + upward %.2f + walk %.2f + M2L %.2f + downward %.2f + near %.2f\n",
+            opt.fmmOrder, t.total, t.build, t.upward, t.traverse, t.m2l, t.downward, t.near);
+        std::printf("  %lld M2L and %lld P2P cell pairs\n", t.m2lPairs, t.p2pPairs);
+    }
+    if (opt.solver == SOLVER_FALCON) {
+        const FmmTimings& t = sim.gravity.falconTimings();
+        std::printf("last falcON evaluation (order %d): %.2f ms = build %.2f + upward %.2f + mutual walk %.2f + downward %.2f + L2P %.2f\n",
+            opt.fmmOrder, t.total, t.build, t.upward, t.traverse, t.downward, t.near);
+        std::printf("  %lld mutual M2L and %lld mutual P2P cell pairs\n", t.m2lPairs, t.p2pPairs);
+    }
+    if (opt.solver == SOLVER_BARNES_HUT) {
+        const TreeStats& t = sim.gravity.treeStats();
+        std::printf("octree upkeep: %lld builds, %lld refits, %.2f ms in all (%.3f ms per force call)\n",
+            t.builds, t.refits, t.totalMs, t.totalMs / std::max(1LL, t.builds + t.refits));
+        std::printf("octree memory: %.1f MB, %.1f bytes/body\n", t.bytes / 1048576.0, (double)t.bytes / sim.bodies.size());
+        if (opt.treeGroupSize > 0) {
+            const GroupWalkStats& g = sim.gravity.groupWalkStats();
+            std::printf("last group walk: %lld groups of up to %d, %.0f cells and %.0f bodies per group\n",
+                g.groups, opt.treeGroupSize, (double)g.cells / std::max(1LL, g.groups),
+                (double)g.particles / std::max(1LL, g.groups));
+        }
+    }
+    if (opt.solver == SOLVER_LBVH) {
+        const LbvhTimings& t = sim.gravity.lbvhTimings();
+        std::printf("last LBVH build: %.2f ms = keys %.2f + sort %.2f + hierarchy %.2f + moments %.2f\n",
+            t.total, t.keys, t.sort, t.hierarchy, t.moments);
+    }
+    if (opt.energy) {
+        double e1 = totalEnergy(sim.bodies, opt.G, pool);
+        std::printf("energy %.8g -> %.8g (drift %.3e)\n", e0, e1, std::abs(e0) > 0.0 ? (e1 - e0) / std::abs(e0) : 0.0);
+        double scale = 0.0;
+        const glm::dvec3 p1 = totalMomentum(sim.bodies, &scale);
+        std::printf("momentum change %.3e of sum |m v|\n", scale > 0.0 ? glm::length(p1 - p0) / scale : 0.0);
+    }
+    if (!opt.output.empty()) {
+        if (!writeStateCsv(sim.bodies, sim.tracers, opt.output)) {
+            std::fprintf(stderr, "Failed to write %s\n", opt.output.c_str());
+            return 1;
+        }
+        std::printf("state written to %s\n", opt.output.c_str());
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef HERMITE_H
+#define HERMITE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "directsum.h"
+#include "integrator.h"
+
+// Accelerations and jerks (da/dt) of every body from every other, O(N^2), in
+// double precision: Hermite differences accelerations over short steps, which
+// single precision can't resolve for long.
+inline void accelJerkDirect(const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& z,
+                            const std::vector<double>& vx, const std::vector<double>& vy, const std::vector<double>& vz,
+                            const std::vector<double>& m, double G, ThreadPool& pool,
+                            std::vector<double>& ax, std::vector<double>& ay, std::vector<double>& az,
+                            std::vector<double>& jx, std::vector<double>& jy, std::vector<double>& jz)
+{
+    const size_t n = x.size();
+    pool.parallelFor(n, 16, [&](size_t b, size_t e, int) {
+        for (size_t i = b; i < e; i++) {
+            double sax = 0.0, say = 0.0, saz = 0.0, sjx = 0.0, sjy = 0.0, sjz = 0.0;
+            for (size_t k = 0; k < n; k++) {
+                const double dx = x[k] - x[i], dy = y[k] - y[i], dz = z[k] - z[i];
+                const double dvx = vx[k] - vx[i], dvy = vy[k] - vy[i], dvz = vz[k] - vz[i];
+                const double r2 = dx * dx + dy * dy + dz * dz + SOFTENING;
+                const double inv2 = 1.0 / r2;
+                const double mInv3 = m[k] * inv2 * std::sqrt(inv2);
+                // jerk: m (dv - 3 (dx.dv / r^2) dx) / r^3; a body's own term is zero
+                const double rv = 3.0 * (dx * dvx + dy * dvy + dz * dvz) * inv2;
+                sax += mInv3 * dx;
+                say += mInv3 * dy;
+                saz += mInv3 * dz;
+                sjx += mInv3 * (dvx - rv * dx);
+                sjy += mInv3 * (dvy - rv * dy);
+                sjz += mInv3 * (dvz - rv * dz);
+            }
+            ax[i] = G * sax; ay[i] = G * say; az[i] = G * saz;
+            jx[i] = G * sjx; jy[i] = G * sjy; jz[i] = G * sjz;
+        }
+    });
+}
+
+// Fourth-order Hermite predictor-corrector (Makino & Aarseth 1992) with a
+// shared adaptive step. Each step predicts positions and velocities from the
+// current acceleration and jerk, evaluates both afresh at the prediction, and
+// corrects with the time-symmetric Hermite interpolant. The step is the
+// smallest over all bodies of Aarseth's criterion,
+// sqrt(eta (|a||a''| + |a'|^2) / (|a'||a'''| + |a''|^2)), using the snap and
+// crackle that the corrector's interpolant gives for free; it may grow by at
+// most 2x per step. One call to step() covers dt in as many such steps as it
+// takes, so close encounters get short steps and quiet stretches long ones.
+//
+// Jerk needs the exact force law, so forces come from a double-precision
+// direct sum here whatever solver the simulation is set to, and the state is
+// kept in double with the float body arrays updated after every call. That
+// makes this an integrator for small collisional systems, not for big N.
+class HermiteIntegrator : public Integrator
+{
+public:
+    float eta = 0.02f;       // Aarseth accuracy parameter
+    float etaStart = 0.01f;  // first step: etaStart |a| / |a'|
+
+    // per call to step()
+    long long lastForceEvals = 0;
+    int lastSubsteps = 0;
+    double lastStep = 0.0;
+
+    void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) override
+    {
+        (void)accel;
+        if (!primed || !inSync(bodies))
+            prime(bodies, pool);
+        const size_t n = x.size();
+        lastForceEvals = 0;
+        lastSubsteps = 0;
+
+        double remaining = dt;
+        while (remaining > 0.0) {
+            double h = std::min(nextStep, remaining);
+            // don't leave a sliver for the last step of the call
+            if (remaining - h < 0.25 * h)
+                h = remaining;
+
+            // predict
+            pool.parallelFor(n, 1024, [&](size_t b, size_t e, int) {
+                for (size_t i = b; i < e; i++) {
+                    const double h2 = h * h / 2.0, h3 = h * h * h / 6.0;
+                    px[i] = x[i] + vx[i] * h + ax[i] * h2 + jx[i] * h3;
+                    py[i] = y[i] + vy[i] * h + ay[i] * h2 + jy[i] * h3;
+                    pz[i] = z[i] + vz[i] * h + az[i] * h2 + jz[i] * h3;
+                    pvx[i] = vx[i] + ax[i] * h + jx[i] * h2;
+                    pvy[i] = vy[i] + ay[i] * h + jy[i] * h2;
+                    pvz[i] = vz[i] + az[i] * h + jz[i] * h2;
+                }
+            });
+            accelJerkDirect(px, py, pz, pvx, pvy, pvz, m, G, pool, ax1, ay1, az1, jx1, jy1, jz1);
+            lastForceEvals += (long long)n;
+
+            // correct, and pick the next step from the end-of-step derivatives
+            std::vector<double> want(pool.size(), 1e300);
+            pool.parallelFor(n, 1024, [&](size_t b, size_t e, int worker) {
+                for (size_t i = b; i < e; i++) {
+                    correct(vx[i], x[i], ax[i], ax1[i], jx[i], jx1[i], h);
+                    correct(vy[i], y[i], ay[i], ay1[i], jy[i], jy1[i], h);
+                    correct(vz[i], z[i], az[i], az1[i], jz[i], jz1[i], h);
+                    want[worker] = std::min(want[worker], aarsethStep(i, h));
+                    ax[i] = ax1[i]; ay[i] = ay1[i]; az[i] = az1[i];
+                    jx[i] = jx1[i]; jy[i] = jy1[i]; jz[i] = jz1[i];
+                }
+            });
+            lastStep = h;
+            nextStep = std::min(2.0 * h, *std::min_element(want.begin(), want.end()));
+            remaining -= h;
+            lastSubsteps++;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            bodies.x[i] = (float)x[i]; bodies.y[i] = (float)y[i]; bodies.z[i] = (float)z[i];
+            bodies.vx[i] = (float)vx[i]; bodies.vy[i] = (float)vy[i]; bodies.vz[i] = (float)vz[i];
+            bodies.ax[i] = (float)ax[i]; bodies.ay[i] = (float)ay[i]; bodies.az[i] = (float)az[i];
+        }
+    }
+
+    void reset() override { primed = false; }
+
+    void reorder(const std::vector<int>& perm) override
+    {
+        if (!primed || x.size() != perm.size())
+            return;
+        for (std::vector<double>* v : { &x, &y, &z, &vx, &vy, &vz, &m, &ax, &ay, &az, &jx, &jy, &jz }) {
+            std::vector<double> out(v->size());
+            for (size_t i = 0; i < perm.size(); i++)
+                out[i] = (*v)[perm[i]];
+            v->swap(out);
+        }
+    }
+
+private:
+    bool primed = false;
+    double nextStep = 0.0;
+    std::vector<double> x, y, z, vx, vy, vz, m;
+    std::vector<double> ax, ay, az, jx, jy, jz;
+    std::vector<double> px, py, pz, pvx, pvy, pvz;
+    std::vector<double> ax1, ay1, az1, jx1, jy1, jz1;
+
+    // one axis of the time-symmetric Hermite corrector
+    static void correct(double& v, double& x, double a0, double a1, double j0, double j1, double h)
+    {
+        const double v0 = v;
+        v = v0 + 0.5 * h * (a0 + a1) + h * h / 12.0 * (j0 - j1);
+        x = x + 0.5 * h * (v0 + v) + h * h / 12.0 * (a0 - a1);
+    }
+
+    // Aarseth's criterion for body i at the end of a step of length h, with
+    // snap and crackle from the interpolant through (a0, j0) and (a1, j1)
+    double aarsethStep(size_t i, double h) const
+    {
+        const double a0[3] = { ax[i], ay[i], az[i] }, a1[3] = { ax1[i], ay1[i], az1[i] };
+        const double j0[3] = { jx[i], jy[i], jz[i] }, j1[3] = { jx1[i], jy1[i], jz1[i] };
+        double a2 = 0.0, j2 = 0.0, s2 = 0.0, c2 = 0.0;
+        for (int d = 0; d < 3; d++) {
+            const double da = a0[d] - a1[d];
+            const double snap0 = (-6.0 * da - h * (4.0 * j0[d] + 2.0 * j1[d])) / (h * h);
+            const double crackle = (12.0 * da + 6.0 * h * (j0[d] + j1[d])) / (h * h * h);
+            const double snap1 = snap0 + crackle * h;
+            a2 += a1[d] * a1[d];
+            j2 += j1[d] * j1[d];
+            s2 += snap1 * snap1;
+            c2 += crackle * crackle;
+        }
+        const double num = std::sqrt(a2 * s2) + j2;
+        const double den = std::sqrt(j2 * c2) + s2;
+        if (den <= 0.0)
+            return 1e300;
+        return std::sqrt(eta * num / den);
+    }
+
+    bool inSync(const BodySoA& bodies) const
+    {
+        if (x.size() != bodies.size())
+            return false;
+        for (size_t i = 0; i < x.size(); i++) {
+            if ((float)x[i] != bodies.x[i] || (float)y[i] != bodies.y[i] || (float)z[i] != bodies.z[i]
+                || (float)vx[i] != bodies.vx[i] || (float)vy[i] != bodies.vy[i] || (float)vz[i] != bodies.vz[i]
+                || (float)m[i] != bodies.mass[i])
+                return false;
+        }
+        return true;
+    }
+
+    // takes over the bodies' state and starts with etaStart |a| / |a'|
+    void prime(const BodySoA& bodies, ThreadPool& pool)
+    {
+        const size_t n = bodies.size();
+        x.assign(bodies.x.begin(), bodies.x.end());
+        y.assign(bodies.y.begin(), bodies.y.end());
+        z.assign(bodies.z.begin(), bodies.z.end());
+        vx.assign(bodies.vx.begin(), bodies.vx.end());
+        vy.assign(bodies.vy.begin(), bodies.vy.end());
+        vz.assign(bodies.vz.begin(), bodies.vz.end());
+        m.assign(bodies.mass.begin(), bodies.mass.end());
+        for (std::vector<double>* v : { &ax, &ay, &az, &jx, &jy, &jz, &px, &py, &pz, &pvx, &pvy, &pvz,
+                                        &ax1, &ay1, &az1, &jx1, &jy1, &jz1 })
+            v->assign(n, 0.0);
+        accelJerkDirect(x, y, z, vx, vy, vz, m, G, pool, ax, ay, az, jx, jy, jz);
+
+        nextStep = 1e300;
+        for (size_t i = 0; i < n; i++) {
+            const double a = std::sqrt(ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i]);
+            const double j = std::sqrt(jx[i] * jx[i] + jy[i] * jy[i] + jz[i] * jz[i]);
+            if (j > 0.0)
+                nextStep = std::min(nextStep, etaStart * a / j);
+        }
+        primed = true;
+    }
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef INITIALCONDITIONS_H
+#define INITIALCONDITIONS_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "body.h"
+
+// n bodies spread uniformly through a 100-unit cube with small random velocities
+inline BodySoA makeUniformCube(int n, unsigned int seed) {
+    BodySoA bodies;
+    bodies.reserve(n);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> distPos(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> distVel(-0.1f, 0.1f);
+    std::uniform_real_distribution<float> distMass(0.5f, 2.0f);
+    std::uniform_real_distribution<float> distColor(0.0f, 1.0f);
+
+    for (int i = 0; i < n; i++) {
+        bodies.push_back({
+            glm::vec3(distPos(rng), distPos(rng), distPos(rng)),
+            glm::vec3(distVel(rng), distVel(rng), distVel(rng)),
+            distMass(rng),
+            glm::vec3(distColor(rng), distColor(rng), distColor(rng))
+            });
+    }
+    return bodies;
+}
+
+// position and velocity on a nearly circular orbit of radius r about mu = G M
+// at the origin: random phase, tilted up to 0.05 rad about a random line of
+// nodes, circular speed give or take 2%
+inline void nearCircularOrbit(double mu, double r, std::mt19937& rng, glm::dvec3& pos, glm::dvec3& vel) {
+    const double pi = 3.14159265358979323846;
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const double phase = 2.0 * pi * unit(rng);
+    const double tilt = 0.05 * unit(rng), node = 2.0 * pi * unit(rng);
+    const double speed = std::sqrt(mu / r) * (0.98 + 0.04 * unit(rng));
+    // in the orbit plane, then tilted about the line of nodes
+    const glm::dvec3 along(std::cos(node), std::sin(node), 0.0);
+    const glm::dvec3 across(-std::sin(node) * std::cos(tilt), std::cos(node) * std::cos(tilt), std::sin(tilt));
+    pos = r * (std::cos(phase) * along + std::sin(phase) * across);
+    vel = speed * (-std::sin(phase) * along + std::cos(phase) * across);
+}
+
+// A star of mass 1000 at the centre and n - 1 small bodies on nearly circular,
+// nearly coplanar orbits between r = 10 and 100, spaced evenly in log r. The
+// satellites share 0.1% of the star's mass. Velocities are for gravity G, and
+// the whole system is moved to its centre-of-mass frame.
+inline BodySoA makePlanetarySystem(int n, unsigned int seed, float G = 1.0f) {
+    const double starMass = 1000.0;
+    BodySoA bodies;
+    bodies.reserve(n);
+    if (n <= 0)
+        return bodies;
+    bodies.push_back({ glm::vec3(0.0f), glm::vec3(0.0f), (float)starMass, glm::vec3(1.0f, 0.9f, 0.5f) });
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_real_distribution<float> distColor(0.3f, 1.0f);
+    const double satelliteMass = 0.001 * starMass / std::max(1, n - 1);
+    for (int i = 1; i < n; i++) {
+        const double r = 10.0 * std::pow(10.0, (i - unit(rng)) / std::max(1, n - 1));
+        glm::dvec3 pos, vel;
+        nearCircularOrbit(G * starMass, r, rng, pos, vel);
+        bodies.push_back({ glm::vec3(pos), glm::vec3(vel), (float)satelliteMass,
+            glm::vec3(distColor(rng), distColor(rng), distColor(rng)) });
+    }
+
+    glm::dvec3 p(0.0), v(0.0);
+    double mass = 0.0;
+    for (size_t i = 0; i < bodies.size(); i++) {
+        p += (double)bodies.mass[i] * glm::dvec3(bodies.x[i], bodies.y[i], bodies.z[i]);
+        v += (double)bodies.mass[i] * glm::dvec3(bodies.vx[i], bodies.vy[i], bodies.vz[i]);
+        mass += bodies.mass[i];
+    }
+    p /= mass;
+    v /= mass;
+    for (size_t i = 0; i < bodies.size(); i++) {
+        bodies.x[i] -= (float)p.x; bodies.y[i] -= (float)p.y; bodies.z[i] -= (float)p.z;
+        bodies.vx[i] -= (float)v.x; bodies.vy[i] -= (float)v.y; bodies.vz[i] -= (float)v.z;
+    }
+    return bodies;
+}
+
+enum Scene {
+    SCENE_CUBE,
+    SCENE_PLANETS
+};
+const char* const sceneNames[] = { "Uniform cube", "Planetary system" };
+
+inline BodySoA makeScene(int scene, int n, unsigned int seed, float G = 1.0f) {
+    if (scene == SCENE_PLANETS)
+        return makePlanetarySystem(n, seed, G);
+    return makeUniformCube(n, seed);
+}
+
+// Appends n zero-mass tracers to a scene: dust through the cube, or a debris
+// disc between r = 5 and 150 about the heaviest body of the planetary system.
+// The simulation splits them off from the massive bodies.
+inline void addTracers(BodySoA& bodies, int scene, int n, unsigned int seed, float G = 1.0f) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_real_distribution<float> distShade(0.3f, 0.6f);
+    bodies.reserve(bodies.size() + n);
+    if (scene == SCENE_PLANETS && !bodies.empty()) {
+        const size_t star = std::max_element(bodies.mass.begin(), bodies.mass.end()) - bodies.mass.begin();
+        const glm::dvec3 c(bodies.pos(star)), cv(bodies.vel(star));
+        for (int i = 0; i < n; i++) {
+            const double r = 5.0 * std::pow(30.0, unit(rng));
+            glm::dvec3 pos, vel;
+            nearCircularOrbit(G * bodies.mass[star], r, rng, pos, vel);
+            const float shade = distShade(rng);
+            bodies.push_back({ glm::vec3(c + pos), glm::vec3(cv + vel), 0.0f, glm::vec3(shade, shade * 0.9f, shade * 0.8f) });
+        }
+        return;
+    }
+    std::uniform_real_distribution<float> distPos(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> distVel(-0.1f, 0.1f);
+    for (int i = 0; i < n; i++) {
+        const float shade = distShade(rng);
+        bodies.push_back({ glm::vec3(distPos(rng), distPos(rng), distPos(rng)),
+            glm::vec3(distVel(rng), distVel(rng), distVel(rng)), 0.0f, glm::vec3(shade) });
+    }
+}
+
+#endif
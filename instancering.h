@@ -0,0 +1,79 @@
+#ifndef INSTANCERING_H
+#define INSTANCERING_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstring>
+
+// Per-instance vertex data in one immutable buffer that stays mapped for the
+// life of the program (glBufferStorage, persistent + coherent). The buffer holds
+// SLOTS copies of the data; each frame writes the next slot and draws from it,
+// and a fence per slot makes sure the CPU never overwrites a region the GPU may
+// still be reading. With three slots the wait practically never blocks.
+class InstanceRing
+{
+public:
+    static const int SLOTS = 3;
+
+    InstanceRing(size_t slotBytes) : slotBytes(slotBytes)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)(slotBytes * SLOTS), NULL, flags);
+        mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(slotBytes * SLOTS), flags);
+        for (int s = 0; s < SLOTS; s++)
+            fences[s] = 0;
+    }
+
+    ~InstanceRing()
+    {
+        for (int s = 0; s < SLOTS; s++) {
+            if (fences[s])
+                glDeleteSync(fences[s]);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    InstanceRing(const InstanceRing&) = delete;
+    InstanceRing& operator=(const InstanceRing&) = delete;
+
+    unsigned int id() const { return buffer; }
+
+    // moves on to the next slot, waiting for the GPU to let go of it, and
+    // returns where to write
+    void* beginWrite()
+    {
+        current = (current + 1) % SLOTS;
+        if (fences[current]) {
+            GLenum status = glClientWaitSync(fences[current], 0, 0);
+            while (status == GL_TIMEOUT_EXPIRED)
+                status = glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            glDeleteSync(fences[current]);
+            fences[current] = 0;
+        }
+        return mapped + current * slotBytes;
+    }
+
+    // byte offset of the slot to draw from
+    size_t offset() const { return current * slotBytes; }
+
+    // call after the draws that read the current slot have been issued
+    void endFrame()
+    {
+        if (fences[current])
+            glDeleteSync(fences[current]);
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    unsigned int buffer = 0;
+    char* mapped = nullptr;
+    size_t slotBytes;
+    int current = 0;
+    GLsync fences[SLOTS];
+};
+
+#endif
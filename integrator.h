@@ -0,0 +1,97 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <functional>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+
+// fills bodies.ax/ay/az for the current positions; given a list, only for those bodies
+typedef std::function<void(BodySoA&, const std::vector<int>* active)> AccelFn;
+// fills tracers.ax/ay/az with the pull of sources on them
+typedef std::function<void(const BodySoA& sources, BodySoA& tracers)> TracerAccelFn;
+
+class Integrator
+{
+public:
+    // for integrators that work out some of the gravity themselves; the
+    // simulation keeps it in step with the force law
+    double G = 1.0;
+    // Massless tracers for integrators that move them through their own map
+    // (movesTracers()), set by the simulation before every step; null if
+    // there are none. tracerAccel works out forces on them.
+    BodySoA* tracers = nullptr;
+    TracerAccelFn tracerAccel;
+
+    virtual ~Integrator() {}
+    // advance every body by dt, calling accel whenever forces are needed
+    virtual void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) = 0;
+    // forget anything cached from earlier steps (the bodies or the force law changed)
+    virtual void reset() {}
+    // the body arrays were reordered so slot i holds what was in slot order[i];
+    // per-body state has to follow. Accelerations move with the bodies.
+    virtual void reorder(const std::vector<int>& order) { (void)order; }
+    // whether step() also moves the tracers; otherwise the simulation gives
+    // them a leapfrog step of their own
+    virtual bool movesTracers() const { return false; }
+};
+
+inline void kick(BodySoA& bodies, float dt, ThreadPool& pool)
+{
+    pool.parallelFor(bodies.size(), 16384, [&](size_t b, size_t e, int) {
+        for (size_t i = b; i < e; i++) {
+            bodies.vx[i] += bodies.ax[i] * dt;
+            bodies.vy[i] += bodies.ay[i] * dt;
+            bodies.vz[i] += bodies.az[i] * dt;
+        }
+    });
+}
+
+inline void drift(BodySoA& bodies, float dt, ThreadPool& pool)
+{
+    pool.parallelFor(bodies.size(), 16384, [&](size_t b, size_t e, int) {
+        for (size_t i = b; i < e; i++) {
+            bodies.x[i] += bodies.vx[i] * dt;
+            bodies.y[i] += bodies.vy[i] * dt;
+            bodies.z[i] += bodies.vz[i] * dt;
+        }
+    });
+}
+
+// the original update: full kick with fresh forces, then drift. First order.
+class SemiImplicitEuler : public Integrator
+{
+public:
+    void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) override
+    {
+        accel(bodies, nullptr);
+        kick(bodies, dt, pool);
+        drift(bodies, dt, pool);
+    }
+};
+
+// Kick-drift-kick leapfrog: second order and symplectic, so energy errors stay
+// bounded instead of drifting. The forces at the end of a step are the ones the
+// next step starts with, so it still costs one force evaluation per step.
+class LeapfrogKDK : public Integrator
+{
+public:
+    void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) override
+    {
+        if (!primed) {
+            accel(bodies, nullptr);
+            primed = true;
+        }
+        kick(bodies, 0.5f * dt, pool);
+        drift(bodies, dt, pool);
+        accel(bodies, nullptr);
+        kick(bodies, 0.5f * dt, pool);
+    }
+
+    void reset() override { primed = false; }
+
+private:
+    bool primed = false;
+};
+
+#endif
@@ -0,0 +1,519 @@
+#ifndef KEPLER_H
+#define KEPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "cpufeatures.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+
+// Stumpff functions c0..c3 of z, with c0 = cos(sqrt z), c1 = sin(sqrt z) / sqrt z
+// and so on for z > 0, their hyperbolic twins for z < 0. The argument is
+// quartered until the series converge in a few terms, then brought back up
+// with the quadrupling identities.
+inline void stumpff(double z, double c[4])
+{
+    int n = 0;
+    while (std::abs(z) > 0.1 && n < 64) {
+        z *= 0.25;
+        n++;
+    }
+    // c3 and c2 from their series, c1 and c0 from the recurrence c_k = 1/k! - z c_{k+2}
+    c[3] = (1.0 - z / 20.0 * (1.0 - z / 42.0 * (1.0 - z / 72.0 * (1.0 - z / 110.0 * (1.0 - z / 156.0))))) / 6.0;
+    c[2] = (1.0 - z / 12.0 * (1.0 - z / 30.0 * (1.0 - z / 56.0 * (1.0 - z / 90.0 * (1.0 - z / 132.0))))) / 2.0;
+    c[1] = 1.0 - z * c[3];
+    c[0] = 1.0 - z * c[2];
+    for (; n > 0; n--) {
+        c[3] = 0.25 * (c[2] + c[0] * c[3]);
+        c[2] = 0.5 * c[1] * c[1];
+        c[1] = c[0] * c[1];
+        c[0] = 2.0 * c[0] * c[0] - 1.0;
+    }
+}
+
+// First guess at the universal anomaly for keplerDrift. dt / r0 is good enough
+// on bound orbits, but on a hyperbola far out it overshoots badly enough for
+// the cosh in the Stumpff functions to overflow. There dt grows like
+// exp(a s) (r0 a^2 + eta0 a + mu) / (2 a^3) with a = sqrt(-beta), and the
+// inverse of that is never larger than dt / r0 need be.
+inline double keplerFirstGuess(double mu, double dt, double r0, double eta0, double beta)
+{
+    double s = dt / r0;
+    if (beta < 0.0) {
+        const double a = std::sqrt(-beta);
+        const double sign = dt < 0.0 ? -1.0 : 1.0;
+        const double scale = std::max(mu + a * (a * r0 + sign * eta0), mu);
+        const double far = sign * std::log1p(2.0 * a * a * a * std::abs(dt) / scale) / a;
+        if (std::abs(far) < std::abs(s))
+            s = far;
+    }
+    return s;
+}
+
+// Moves a body dt along its two-body orbit about a mass with mu = G M at the
+// origin, for any eccentricity, by solving Kepler's equation in the universal
+// anomaly s. With beta = 2 mu / r0 - v0^2 and G_k = s^k c_k(beta s^2),
+//   dt = r0 G1 + eta0 G2 + mu G3,   r = r0 G0 + eta0 G1 + mu G2 = d(dt)/ds,
+// solved with Laguerre-Conway iteration, which converges from a crude first
+// guess even on very eccentric orbits. Bound orbits first drop whole
+// periods from dt. Returns false if the iteration did not converge, in which
+// case the state is left alone.
+inline bool keplerDrift(double mu, double dt, double& x, double& y, double& z, double& vx, double& vy, double& vz)
+{
+    const double r0 = std::sqrt(x * x + y * y + z * z);
+    const double v2 = vx * vx + vy * vy + vz * vz;
+    const double eta0 = x * vx + y * vy + z * vz;
+    const double beta = 2.0 * mu / r0 - v2;
+    if (r0 <= 0.0 || mu <= 0.0)
+        return false;
+
+    if (beta > 0.0) {
+        const double pi = 3.14159265358979323846;
+        const double period = 2.0 * pi * mu / (beta * std::sqrt(beta));
+        dt = std::fmod(dt, period);
+    }
+
+    double s = keplerFirstGuess(mu, dt, r0, eta0, beta);
+    double c[4], G0 = 1.0, G1 = 0.0, G2 = 0.0, G3 = 0.0, r = r0;
+    bool converged = false;
+    for (int it = 0; it < 50; it++) {
+        const double s2 = s * s;
+        stumpff(beta * s2, c);
+        G0 = c[0];
+        G1 = s * c[1];
+        G2 = s2 * c[2];
+        G3 = s2 * s * c[3];
+        r = r0 * G0 + eta0 * G1 + mu * G2;
+        const double f = r0 * G1 + eta0 * G2 + mu * G3 - dt;
+        // near pericentre of a very eccentric orbit f is a small difference of
+        // big terms, and dividing by the small r there leaves ds at round-off
+        // long before 1e-13 s; f that small is as converged as it gets
+        const double noise = 1e-14 * (std::abs(r0 * G1) + std::abs(eta0 * G2) + std::abs(mu * G3) + std::abs(dt));
+        const double df = r;
+        const double ddf = eta0 * G0 + (mu - beta * r0) * G1;
+        // Laguerre step with n = 5
+        const double disc = std::sqrt(std::abs(16.0 * df * df - 20.0 * f * ddf));
+        const double ds = -5.0 * f / (df + (df >= 0.0 ? disc : -disc));
+        s += ds;
+        if (std::abs(ds) <= 1e-13 * std::abs(s) || std::abs(f) <= noise) {
+            converged = true;
+            break;
+        }
+    }
+    if (!converged || !(r > 0.0))
+        return false;
+
+    // refresh the G functions at the final s
+    const double s2 = s * s;
+    stumpff(beta * s2, c);
+    G0 = c[0];
+    G1 = s * c[1];
+    G2 = s2 * c[2];
+    G3 = s2 * s * c[3];
+    r = r0 * G0 + eta0 * G1 + mu * G2;
+
+    const double f = 1.0 - mu * G2 / r0;
+    const double g = dt - mu * G3;
+    const double fdot = -mu * G1 / (r0 * r);
+    const double gdot = 1.0 - mu * G2 / r;
+    const double nx = f * x + g * vx, ny = f * y + g * vy, nz = f * z + g * vz;
+    vx = fdot * x + gdot * vx;
+    vy = fdot * y + gdot * vy;
+    vz = fdot * z + gdot * vz;
+    x = nx;
+    y = ny;
+    z = nz;
+    return true;
+}
+
+// Drifts n bodies at once, each about the same mass at the origin, by the
+// same dt: x[i] .. vz[i] go through keplerDrift. ok[i] (if given) is set to 1
+// for every body that moved and 0 for any that was left alone; returns how
+// many were left alone.
+typedef size_t (*KeplerBatchKernel)(double mu, double dt, size_t n, double* x, double* y, double* z,
+                                    double* vx, double* vy, double* vz, unsigned char* ok);
+
+inline size_t keplerDriftBatchScalar(double mu, double dt, size_t n, double* x, double* y, double* z,
+                                     double* vx, double* vy, double* vz, unsigned char* ok)
+{
+    size_t failed = 0;
+    for (size_t i = 0; i < n; i++) {
+        const bool moved = keplerDrift(mu, dt, x[i], y[i], z[i], vx[i], vy[i], vz[i]);
+        if (ok)
+            ok[i] = moved ? 1 : 0;
+        failed += moved ? 0 : 1;
+    }
+    return failed;
+}
+
+#ifdef ORBO_X86
+
+// The SIMD versions run the scalar solver on 4 (AVX2) or 8 (AVX-512) bodies
+// per register, one body per lane. Every lane takes the same number of
+// Laguerre steps; a lane that has converged has its updates masked off, and
+// the block stops as soon as none is left. The Stumpff functions do the same:
+// each lane is quartered and re-quadrupled as often as its own z needs. A
+// short tail is padded out with copies of its last body.
+
+// 1 - z / a (1 - z / b (1 - z / c (1 - z / d (1 - z / e)))), from the inside out
+ORBO_TARGET("avx2,fma")
+inline __m256d stumpffSeriesAVX2(__m256d z, double a, double b, double c, double d, double e)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256d t = _mm256_fnmadd_pd(z, _mm256_set1_pd(1.0 / e), one);
+    t = _mm256_fnmadd_pd(_mm256_mul_pd(z, _mm256_set1_pd(1.0 / d)), t, one);
+    t = _mm256_fnmadd_pd(_mm256_mul_pd(z, _mm256_set1_pd(1.0 / c)), t, one);
+    t = _mm256_fnmadd_pd(_mm256_mul_pd(z, _mm256_set1_pd(1.0 / b)), t, one);
+    return _mm256_fnmadd_pd(_mm256_mul_pd(z, _mm256_set1_pd(1.0 / a)), t, one);
+}
+
+// keplerFirstGuess lane by lane, for blocks with a hyperbola in them (there is
+// no vector log to do it in registers); t comes back as the guess
+inline void keplerFirstGuessLanes(int lanes, double mu, double* t, const double* r0, const double* eta0, const double* beta)
+{
+    for (int l = 0; l < lanes; l++)
+        t[l] = keplerFirstGuess(mu, t[l], r0[l], eta0[l], beta[l]);
+}
+
+ORBO_TARGET("avx2,fma")
+inline void stumpffAVX2(__m256d z, __m256d& c0, __m256d& c1, __m256d& c2, __m256d& c3)
+{
+    const __m256d signBit = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0), quarter = _mm256_set1_pd(0.25);
+    __m256d n = _mm256_setzero_pd();
+    for (int it = 0; it < 64; it++) {
+        const __m256d big = _mm256_cmp_pd(_mm256_andnot_pd(signBit, z), _mm256_set1_pd(0.1), _CMP_GT_OQ);
+        if (_mm256_movemask_pd(big) == 0)
+            break;
+        z = _mm256_blendv_pd(z, _mm256_mul_pd(z, quarter), big);
+        n = _mm256_add_pd(n, _mm256_and_pd(big, one));
+    }
+    c3 = _mm256_mul_pd(stumpffSeriesAVX2(z, 20.0, 42.0, 72.0, 110.0, 156.0), _mm256_set1_pd(1.0 / 6.0));
+    c2 = _mm256_mul_pd(stumpffSeriesAVX2(z, 12.0, 30.0, 56.0, 90.0, 132.0), _mm256_set1_pd(0.5));
+    c1 = _mm256_fnmadd_pd(z, c3, one);
+    c0 = _mm256_fnmadd_pd(z, c2, one);
+    for (;;) {
+        const __m256d up = _mm256_cmp_pd(n, _mm256_setzero_pd(), _CMP_GT_OQ);
+        if (_mm256_movemask_pd(up) == 0)
+            break;
+        const __m256d n3 = _mm256_mul_pd(quarter, _mm256_fmadd_pd(c0, c3, c2));
+        const __m256d n2 = _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_mul_pd(c1, c1));
+        const __m256d n1 = _mm256_mul_pd(c0, c1);
+        const __m256d n0 = _mm256_fmsub_pd(_mm256_add_pd(c0, c0), c0, one);
+        c3 = _mm256_blendv_pd(c3, n3, up);
+        c2 = _mm256_blendv_pd(c2, n2, up);
+        c1 = _mm256_blendv_pd(c1, n1, up);
+        c0 = _mm256_blendv_pd(c0, n0, up);
+        n = _mm256_sub_pd(n, _mm256_and_pd(up, one));
+    }
+}
+
+// four bodies in place; returns a lane mask of the ones that moved
+ORBO_TARGET("avx2,fma")
+inline int keplerBlockAVX2(double mu, double dt, double* x, double* y, double* z, double* vx, double* vy, double* vz)
+{
+    const double pi = 3.14159265358979323846;
+    const __m256d signBit = _mm256_set1_pd(-0.0), zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+    const __m256d vMu = _mm256_set1_pd(mu), vDt = _mm256_set1_pd(dt);
+    const __m256d px = _mm256_loadu_pd(x), py = _mm256_loadu_pd(y), pz = _mm256_loadu_pd(z);
+    const __m256d qx = _mm256_loadu_pd(vx), qy = _mm256_loadu_pd(vy), qz = _mm256_loadu_pd(vz);
+
+    const __m256d r0 = _mm256_sqrt_pd(_mm256_fmadd_pd(px, px, _mm256_fmadd_pd(py, py, _mm256_mul_pd(pz, pz))));
+    const __m256d v2 = _mm256_fmadd_pd(qx, qx, _mm256_fmadd_pd(qy, qy, _mm256_mul_pd(qz, qz)));
+    const __m256d eta0 = _mm256_fmadd_pd(px, qx, _mm256_fmadd_pd(py, qy, _mm256_mul_pd(pz, qz)));
+    const __m256d beta = _mm256_sub_pd(_mm256_div_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), vMu), r0), v2);
+    const __m256d valid = _mm256_and_pd(_mm256_cmp_pd(r0, zero, _CMP_GT_OQ), _mm256_cmp_pd(vMu, zero, _CMP_GT_OQ));
+
+    // whole periods off bound orbits
+    const __m256d bound = _mm256_cmp_pd(beta, zero, _CMP_GT_OQ);
+    const __m256d period = _mm256_div_pd(_mm256_set1_pd(2.0 * pi * mu), _mm256_mul_pd(beta, _mm256_sqrt_pd(beta)));
+    const __m256d reduced = _mm256_fnmadd_pd(period, _mm256_floor_pd(_mm256_div_pd(vDt, period)), vDt);
+    const __m256d t = _mm256_blendv_pd(vDt, reduced, bound);
+
+    const __m256d mbr = _mm256_fnmadd_pd(beta, r0, vMu);
+    __m256d s = _mm256_and_pd(_mm256_div_pd(t, r0), valid);
+    if (_mm256_movemask_pd(_mm256_cmp_pd(beta, zero, _CMP_LT_OQ)) != 0) {
+        alignas(32) double lt[4], lr[4], le[4], lb[4];
+        _mm256_store_pd(lt, t);
+        _mm256_store_pd(lr, r0);
+        _mm256_store_pd(le, eta0);
+        _mm256_store_pd(lb, beta);
+        keplerFirstGuessLanes(4, mu, lt, lr, le, lb);
+        s = _mm256_and_pd(_mm256_load_pd(lt), valid);
+    }
+    __m256d active = valid;
+    __m256d c0, c1, c2, c3, G0, G1, G2, G3, r;
+    for (int it = 0; it < 50; it++) {
+        const __m256d s2 = _mm256_mul_pd(s, s);
+        stumpffAVX2(_mm256_mul_pd(beta, s2), c0, c1, c2, c3);
+        G0 = c0;
+        G1 = _mm256_mul_pd(s, c1);
+        G2 = _mm256_mul_pd(s2, c2);
+        G3 = _mm256_mul_pd(_mm256_mul_pd(s2, s), c3);
+        r = _mm256_fmadd_pd(r0, G0, _mm256_fmadd_pd(eta0, G1, _mm256_mul_pd(vMu, G2)));
+        const __m256d f = _mm256_sub_pd(_mm256_fmadd_pd(r0, G1, _mm256_fmadd_pd(eta0, G2, _mm256_mul_pd(vMu, G3))), t);
+        const __m256d noise = _mm256_mul_pd(_mm256_set1_pd(1e-14), _mm256_add_pd(
+            _mm256_add_pd(_mm256_andnot_pd(signBit, _mm256_mul_pd(r0, G1)), _mm256_andnot_pd(signBit, _mm256_mul_pd(eta0, G2))),
+            _mm256_add_pd(_mm256_andnot_pd(signBit, _mm256_mul_pd(vMu, G3)), _mm256_andnot_pd(signBit, t))));
+        const __m256d ddf = _mm256_fmadd_pd(eta0, G0, _mm256_mul_pd(mbr, G1));
+        const __m256d d = _mm256_fmsub_pd(_mm256_set1_pd(16.0), _mm256_mul_pd(r, r), _mm256_mul_pd(_mm256_set1_pd(20.0), _mm256_mul_pd(f, ddf)));
+        const __m256d disc = _mm256_sqrt_pd(_mm256_andnot_pd(signBit, d));
+        const __m256d den = _mm256_add_pd(r, _mm256_blendv_pd(_mm256_xor_pd(disc, signBit), disc, _mm256_cmp_pd(r, zero, _CMP_GE_OQ)));
+        const __m256d ds = _mm256_and_pd(_mm256_div_pd(_mm256_mul_pd(_mm256_set1_pd(-5.0), f), den), active);
+        s = _mm256_add_pd(s, ds);
+        const __m256d done = _mm256_or_pd(
+            _mm256_cmp_pd(_mm256_andnot_pd(signBit, ds), _mm256_mul_pd(_mm256_set1_pd(1e-13), _mm256_andnot_pd(signBit, s)), _CMP_LE_OQ),
+            _mm256_cmp_pd(_mm256_andnot_pd(signBit, f), noise, _CMP_LE_OQ));
+        active = _mm256_andnot_pd(done, active);
+        if (_mm256_movemask_pd(active) == 0)
+            break;
+    }
+
+    // the G functions at the final s
+    const __m256d s2 = _mm256_mul_pd(s, s);
+    stumpffAVX2(_mm256_mul_pd(beta, s2), c0, c1, c2, c3);
+    G1 = _mm256_mul_pd(s, c1);
+    G2 = _mm256_mul_pd(s2, c2);
+    G3 = _mm256_mul_pd(_mm256_mul_pd(s2, s), c3);
+    r = _mm256_fmadd_pd(r0, c0, _mm256_fmadd_pd(eta0, G1, _mm256_mul_pd(vMu, G2)));
+    const __m256d ok = _mm256_and_pd(_mm256_andnot_pd(active, valid), _mm256_cmp_pd(r, zero, _CMP_GT_OQ));
+
+    const __m256d muG2 = _mm256_mul_pd(vMu, G2);
+    const __m256d f = _mm256_sub_pd(one, _mm256_div_pd(muG2, r0));
+    const __m256d g = _mm256_fnmadd_pd(vMu, G3, t);
+    const __m256d fdot = _mm256_div_pd(_mm256_mul_pd(vMu, G1), _mm256_mul_pd(_mm256_xor_pd(r0, signBit), r));
+    const __m256d gdot = _mm256_sub_pd(one, _mm256_div_pd(muG2, r));
+    _mm256_storeu_pd(x, _mm256_blendv_pd(px, _mm256_fmadd_pd(f, px, _mm256_mul_pd(g, qx)), ok));
+    _mm256_storeu_pd(y, _mm256_blendv_pd(py, _mm256_fmadd_pd(f, py, _mm256_mul_pd(g, qy)), ok));
+    _mm256_storeu_pd(z, _mm256_blendv_pd(pz, _mm256_fmadd_pd(f, pz, _mm256_mul_pd(g, qz)), ok));
+    _mm256_storeu_pd(vx, _mm256_blendv_pd(qx, _mm256_fmadd_pd(fdot, px, _mm256_mul_pd(gdot, qx)), ok));
+    _mm256_storeu_pd(vy, _mm256_blendv_pd(qy, _mm256_fmadd_pd(fdot, py, _mm256_mul_pd(gdot, qy)), ok));
+    _mm256_storeu_pd(vz, _mm256_blendv_pd(qz, _mm256_fmadd_pd(fdot, pz, _mm256_mul_pd(gdot, qz)), ok));
+    return _mm256_movemask_pd(ok);
+}
+
+// 1 - z / a (1 - z / b (1 - z / c (1 - z / d (1 - z / e)))), from the inside out
+ORBO_TARGET("avx512f")
+inline __m512d stumpffSeriesAVX512(__m512d z, double a, double b, double c, double d, double e)
+{
+    const __m512d one = _mm512_set1_pd(1.0);
+    __m512d t = _mm512_fnmadd_pd(z, _mm512_set1_pd(1.0 / e), one);
+    t = _mm512_fnmadd_pd(_mm512_mul_pd(z, _mm512_set1_pd(1.0 / d)), t, one);
+    t = _mm512_fnmadd_pd(_mm512_mul_pd(z, _mm512_set1_pd(1.0 / c)), t, one);
+    t = _mm512_fnmadd_pd(_mm512_mul_pd(z, _mm512_set1_pd(1.0 / b)), t, one);
+    return _mm512_fnmadd_pd(_mm512_mul_pd(z, _mm512_set1_pd(1.0 / a)), t, one);
+}
+
+ORBO_TARGET("avx512f")
+inline void stumpffAVX512(__m512d z, __m512d& c0, __m512d& c1, __m512d& c2, __m512d& c3)
+{
+    const __m512d one = _mm512_set1_pd(1.0), quarter = _mm512_set1_pd(0.25);
+    __m512i n = _mm512_setzero_si512();
+    for (int it = 0; it < 64; it++) {
+        const __mmask8 big = _mm512_cmp_pd_mask(_mm512_abs_pd(z), _mm512_set1_pd(0.1), _CMP_GT_OQ);
+        if (big == 0)
+            break;
+        z = _mm512_mask_mul_pd(z, big, z, quarter);
+        n = _mm512_mask_add_epi64(n, big, n, _mm512_set1_epi64(1));
+    }
+    c3 = _mm512_mul_pd(stumpffSeriesAVX512(z, 20.0, 42.0, 72.0, 110.0, 156.0), _mm512_set1_pd(1.0 / 6.0));
+    c2 = _mm512_mul_pd(stumpffSeriesAVX512(z, 12.0, 30.0, 56.0, 90.0, 132.0), _mm512_set1_pd(0.5));
+    c1 = _mm512_fnmadd_pd(z, c3, one);
+    c0 = _mm512_fnmadd_pd(z, c2, one);
+    for (;;) {
+        const __mmask8 up = _mm512_cmpgt_epi64_mask(n, _mm512_setzero_si512());
+        if (up == 0)
+            break;
+        const __m512d n3 = _mm512_mul_pd(quarter, _mm512_fmadd_pd(c0, c3, c2));
+        const __m512d n2 = _mm512_mul_pd(_mm512_set1_pd(0.5), _mm512_mul_pd(c1, c1));
+        const __m512d n1 = _mm512_mul_pd(c0, c1);
+        c0 = _mm512_mask_mov_pd(c0, up, _mm512_fmsub_pd(_mm512_add_pd(c0, c0), c0, one));
+        c1 = _mm512_mask_mov_pd(c1, up, n1);
+        c2 = _mm512_mask_mov_pd(c2, up, n2);
+        c3 = _mm512_mask_mov_pd(c3, up, n3);
+        n = _mm512_mask_sub_epi64(n, up, n, _mm512_set1_epi64(1));
+    }
+}
+
+// eight bodies in place; returns a lane mask of the ones that moved
+ORBO_TARGET("avx512f")
+inline int keplerBlockAVX512(double mu, double dt, double* x, double* y, double* z, double* vx, double* vy, double* vz)
+{
+    const double pi = 3.14159265358979323846;
+    const __m512d zero = _mm512_setzero_pd(), one = _mm512_set1_pd(1.0);
+    const __m512d vMu = _mm512_set1_pd(mu), vDt = _mm512_set1_pd(dt);
+    const __m512d px = _mm512_loadu_pd(x), py = _mm512_loadu_pd(y), pz = _mm512_loadu_pd(z);
+    const __m512d qx = _mm512_loadu_pd(vx), qy = _mm512_loadu_pd(vy), qz = _mm512_loadu_pd(vz);
+
+    const __m512d r0 = _mm512_sqrt_pd(_mm512_fmadd_pd(px, px, _mm512_fmadd_pd(py, py, _mm512_mul_pd(pz, pz))));
+    const __m512d v2 = _mm512_fmadd_pd(qx, qx, _mm512_fmadd_pd(qy, qy, _mm512_mul_pd(qz, qz)));
+    const __m512d eta0 = _mm512_fmadd_pd(px, qx, _mm512_fmadd_pd(py, qy, _mm512_mul_pd(pz, qz)));
+    const __m512d beta = _mm512_sub_pd(_mm512_div_pd(_mm512_mul_pd(_mm512_set1_pd(2.0), vMu), r0), v2);
+    const __mmask8 valid = mu > 0.0 ? _mm512_cmp_pd_mask(r0, zero, _CMP_GT_OQ) : (__mmask8)0;
+
+    const __mmask8 bound = _mm512_cmp_pd_mask(beta, zero, _CMP_GT_OQ);
+    const __m512d period = _mm512_div_pd(_mm512_set1_pd(2.0 * pi * mu), _mm512_mul_pd(beta, _mm512_sqrt_pd(beta)));
+    const __m512d cycles = _mm512_roundscale_pd(_mm512_div_pd(vDt, period), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    const __m512d t = _mm512_mask_mov_pd(vDt, bound, _mm512_fnmadd_pd(period, cycles, vDt));
+
+    const __m512d mbr = _mm512_fnmadd_pd(beta, r0, vMu);
+    __m512d s = _mm512_maskz_div_pd(valid, t, r0);
+    if (_mm512_cmp_pd_mask(beta, zero, _CMP_LT_OQ) != 0) {
+        alignas(64) double lt[8], lr[8], le[8], lb[8];
+        _mm512_store_pd(lt, t);
+        _mm512_store_pd(lr, r0);
+        _mm512_store_pd(le, eta0);
+        _mm512_store_pd(lb, beta);
+        keplerFirstGuessLanes(8, mu, lt, lr, le, lb);
+        s = _mm512_maskz_mov_pd(valid, _mm512_load_pd(lt));
+    }
+    __mmask8 active = valid;
+    __m512d c0, c1, c2, c3, G0, G1, G2, G3, r;
+    for (int it = 0; it < 50; it++) {
+        const __m512d s2 = _mm512_mul_pd(s, s);
+        stumpffAVX512(_mm512_mul_pd(beta, s2), c0, c1, c2, c3);
+        G0 = c0;
+        G1 = _mm512_mul_pd(s, c1);
+        G2 = _mm512_mul_pd(s2, c2);
+        G3 = _mm512_mul_pd(_mm512_mul_pd(s2, s), c3);
+        r = _mm512_fmadd_pd(r0, G0, _mm512_fmadd_pd(eta0, G1, _mm512_mul_pd(vMu, G2)));
+        const __m512d f = _mm512_sub_pd(_mm512_fmadd_pd(r0, G1, _mm512_fmadd_pd(eta0, G2, _mm512_mul_pd(vMu, G3))), t);
+        const __m512d noise = _mm512_mul_pd(_mm512_set1_pd(1e-14), _mm512_add_pd(
+            _mm512_add_pd(_mm512_abs_pd(_mm512_mul_pd(r0, G1)), _mm512_abs_pd(_mm512_mul_pd(eta0, G2))),
+            _mm512_add_pd(_mm512_abs_pd(_mm512_mul_pd(vMu, G3)), _mm512_abs_pd(t))));
+        const __m512d ddf = _mm512_fmadd_pd(eta0, G0, _mm512_mul_pd(mbr, G1));
+        const __m512d d = _mm512_fmsub_pd(_mm512_set1_pd(16.0), _mm512_mul_pd(r, r), _mm512_mul_pd(_mm512_set1_pd(20.0), _mm512_mul_pd(f, ddf)));
+        const __m512d disc = _mm512_sqrt_pd(_mm512_abs_pd(d));
+        const __mmask8 neg = _mm512_cmp_pd_mask(r, zero, _CMP_LT_OQ);
+        const __m512d den = _mm512_add_pd(r, _mm512_mask_sub_pd(disc, neg, zero, disc));
+        const __m512d ds = _mm512_maskz_div_pd(active, _mm512_mul_pd(_mm512_set1_pd(-5.0), f), den);
+        s = _mm512_add_pd(s, ds);
+        const __mmask8 done = _mm512_cmp_pd_mask(_mm512_abs_pd(ds), _mm512_mul_pd(_mm512_set1_pd(1e-13), _mm512_abs_pd(s)), _CMP_LE_OQ)
+            | _mm512_cmp_pd_mask(_mm512_abs_pd(f), noise, _CMP_LE_OQ);
+        active = (__mmask8)(active & ~done);
+        if (active == 0)
+            break;
+    }
+
+    const __m512d s2 = _mm512_mul_pd(s, s);
+    stumpffAVX512(_mm512_mul_pd(beta, s2), c0, c1, c2, c3);
+    G1 = _mm512_mul_pd(s, c1);
+    G2 = _mm512_mul_pd(s2, c2);
+    G3 = _mm512_mul_pd(_mm512_mul_pd(s2, s), c3);
+    r = _mm512_fmadd_pd(r0, c0, _mm512_fmadd_pd(eta0, G1, _mm512_mul_pd(vMu, G2)));
+    const __mmask8 ok = (__mmask8)(valid & ~active & _mm512_cmp_pd_mask(r, zero, _CMP_GT_OQ));
+
+    const __m512d muG2 = _mm512_mul_pd(vMu, G2);
+    const __m512d f = _mm512_sub_pd(one, _mm512_div_pd(muG2, r0));
+    const __m512d g = _mm512_fnmadd_pd(vMu, G3, t);
+    const __m512d fdot = _mm512_div_pd(_mm512_mul_pd(vMu, G1), _mm512_mul_pd(_mm512_sub_pd(zero, r0), r));
+    const __m512d gdot = _mm512_sub_pd(one, _mm512_div_pd(muG2, r));
+    _mm512_storeu_pd(x, _mm512_mask_mov_pd(px, ok, _mm512_fmadd_pd(f, px, _mm512_mul_pd(g, qx))));
+    _mm512_storeu_pd(y, _mm512_mask_mov_pd(py, ok, _mm512_fmadd_pd(f, py, _mm512_mul_pd(g, qy))));
+    _mm512_storeu_pd(z, _mm512_mask_mov_pd(pz, ok, _mm512_fmadd_pd(f, pz, _mm512_mul_pd(g, qz))));
+    _mm512_storeu_pd(vx, _mm512_mask_mov_pd(qx, ok, _mm512_fmadd_pd(fdot, px, _mm512_mul_pd(gdot, qx))));
+    _mm512_storeu_pd(vy, _mm512_mask_mov_pd(qy, ok, _mm512_fmadd_pd(fdot, py, _mm512_mul_pd(gdot, qy))));
+    _mm512_storeu_pd(vz, _mm512_mask_mov_pd(qz, ok, _mm512_fmadd_pd(fdot, pz, _mm512_mul_pd(gdot, qz))));
+    return ok;
+}
+
+// whole blocks straight from the arrays, the tail through a padded copy
+template <int W, typename Block>
+inline size_t keplerDriftBlocks(Block block, double mu, double dt, size_t n, double* x, double* y, double* z,
+                                double* vx, double* vy, double* vz, unsigned char* ok)
+{
+    size_t failed = 0;
+    for (size_t i = 0; i < n; i += W) {
+        const size_t m = std::min((size_t)W, n - i);
+        int moved;
+        if (m == (size_t)W) {
+            moved = block(mu, dt, x + i, y + i, z + i, vx + i, vy + i, vz + i);
+        }
+        else {
+            double buf[6][W];
+            double* arrays[6] = { x, y, z, vx, vy, vz };
+            for (int a = 0; a < 6; a++) {
+                for (size_t l = 0; l < (size_t)W; l++)
+                    buf[a][l] = arrays[a][i + std::min(l, m - 1)];
+            }
+            moved = block(mu, dt, buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+            for (int a = 0; a < 6; a++) {
+                for (size_t l = 0; l < m; l++)
+                    arrays[a][i + l] = buf[a][l];
+            }
+        }
+        for (size_t l = 0; l < m; l++) {
+            const bool lane = ((moved >> l) & 1) != 0;
+            if (ok)
+                ok[i + l] = lane ? 1 : 0;
+            failed += lane ? 0 : 1;
+        }
+    }
+    return failed;
+}
+
+inline size_t keplerDriftBatchAVX2(double mu, double dt, size_t n, double* x, double* y, double* z,
+                                   double* vx, double* vy, double* vz, unsigned char* ok)
+{
+    return keplerDriftBlocks<4>(keplerBlockAVX2, mu, dt, n, x, y, z, vx, vy, vz, ok);
+}
+
+inline size_t keplerDriftBatchAVX512(double mu, double dt, size_t n, double* x, double* y, double* z,
+                                     double* vx, double* vy, double* vz, unsigned char* ok)
+{
+    return keplerDriftBlocks<8>(keplerBlockAVX512, mu, dt, n, x, y, z, vx, vy, vz, ok);
+}
+
+#endif
+
+// SSE has only two doubles a register, which isn't worth the masking; it gets the scalar loop
+inline KeplerBatchKernel keplerBatchKernelFor(SimdLevel level)
+{
+#ifdef ORBO_X86
+    switch (level) {
+    case SIMD_AVX512: return keplerDriftBatchAVX512;
+    case SIMD_AVX2: return keplerDriftBatchAVX2;
+    default: break;
+    }
+#endif
+    return keplerDriftBatchScalar;
+}
+
+// batched drift with whichever kernel the active SIMD level allows
+inline size_t keplerDriftBatch(double mu, double dt, size_t n, double* x, double* y, double* z,
+                               double* vx, double* vy, double* vz, unsigned char* ok = nullptr)
+{
+    return keplerBatchKernelFor(activeSimdLevel())(mu, dt, n, x, y, z, vx, vy, vz, ok);
+}
+
+// The same spread over the pool. Bodies the solver can't handle (one on top of
+// the central mass) go in a straight line instead; returns how many did.
+inline int keplerDriftParallel(double mu, double dt, size_t n, double* x, double* y, double* z,
+                               double* vx, double* vy, double* vz, ThreadPool& pool)
+{
+    const KeplerBatchKernel kernel = keplerBatchKernelFor(activeSimdLevel());
+    std::vector<int> failures(pool.size(), 0);
+    pool.parallelFor(n, 1024, [&](size_t b, size_t e, int worker) {
+        unsigned char ok[256];
+        for (size_t k0 = b; k0 < e; k0 += 256) {
+            const size_t nk = std::min((size_t)256, e - k0);
+            if (kernel(mu, dt, nk, &x[k0], &y[k0], &z[k0], &vx[k0], &vy[k0], &vz[k0], ok) == 0)
+                continue;
+            for (size_t k = k0; k < k0 + nk; k++) {
+                if (ok[k - k0])
+                    continue;
+                x[k] += vx[k] * dt;
+                y[k] += vy[k] * dt;
+                z[k] += vz[k] * dt;
+                failures[worker]++;
+            }
+        }
+    });
+    int total = 0;
+    for (int f : failures)
+        total += f;
+    return total;
+}
+
+#endif
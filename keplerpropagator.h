@@ -0,0 +1,128 @@
+#ifndef KEPLERPROPAGATOR_H
+#define KEPLERPROPAGATOR_H
+
+#include <algorithm>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "integrator.h"
+#include "kepler.h"
+#include "tracers.h"
+
+// Analytic propagation: no forces at all. The heaviest body coasts in a
+// straight line and everything else follows its Kepler orbit about it,
+// G m0 and nothing else, as test particles would. Each step is one batched
+// universal-variable solve per body, so it costs O(N) whatever dt is and is
+// exact for any dt, however long. The satellites' masses and their pull on
+// each other and on the central body are ignored; use Wisdom-Holman when
+// they matter. Massless tracers follow Kepler orbits about the same body.
+class KeplerPropagator : public Integrator
+{
+public:
+    bool movesTracers() const override { return true; }
+
+    // drifts in the last call that Kepler's equation couldn't be solved for
+    // (a body on top of the central one) and were done in a straight line
+    int lastKeplerFailures = 0;
+
+    void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) override
+    {
+        (void)accel;
+        if (bodies.size() == 0)
+            return;
+        if (!primed || !inSync(bodies))
+            prime(bodies);
+        const double h = dt;
+        const double mu = G * m[central];
+        lastKeplerFailures = keplerDriftParallel(mu, h, satellites.size(), qx.data(), qy.data(), qz.data(),
+                                                 wx.data(), wy.data(), wz.data(), pool);
+
+        // tracers go round the same central body, which moves in a straight line
+        const glm::dvec3 c0(x[central], y[central], z[central]), v0(vx[central], vy[central], vz[central]);
+        if (tracers && !tracers->empty())
+            lastKeplerFailures += keplerDriftTracers(*tracers, mu, h, c0, v0, c0 + v0 * h, v0, pool);
+
+        x[central] += vx[central] * h;
+        y[central] += vy[central] * h;
+        z[central] += vz[central] * h;
+        for (size_t k = 0; k < satellites.size(); k++) {
+            const int i = satellites[k];
+            x[i] = x[central] + qx[k]; y[i] = y[central] + qy[k]; z[i] = z[central] + qz[k];
+            vx[i] = vx[central] + wx[k]; vy[i] = vy[central] + wy[k]; vz[i] = vz[central] + wz[k];
+        }
+        for (size_t i = 0; i < m.size(); i++) {
+            bodies.x[i] = (float)x[i]; bodies.y[i] = (float)y[i]; bodies.z[i] = (float)z[i];
+            bodies.vx[i] = (float)vx[i]; bodies.vy[i] = (float)vy[i]; bodies.vz[i] = (float)vz[i];
+        }
+    }
+
+    void reset() override { primed = false; }
+
+    void reorder(const std::vector<int>& perm) override
+    {
+        if (!primed || m.size() != perm.size())
+            return;
+        for (std::vector<double>* v : { &m, &x, &y, &z, &vx, &vy, &vz }) {
+            std::vector<double> out(v->size());
+            for (size_t i = 0; i < perm.size(); i++)
+                out[i] = (*v)[perm[i]];
+            v->swap(out);
+        }
+        std::vector<int> slot(perm.size());
+        for (size_t i = 0; i < perm.size(); i++)
+            slot[perm[i]] = (int)i;
+        central = slot[central];
+        for (int& i : satellites)
+            i = slot[i];
+    }
+
+private:
+    bool primed = false;
+    int central = 0;
+    // satellite k sits in body slot satellites[k]; position and velocity
+    // relative to the central body
+    std::vector<int> satellites;
+    std::vector<double> qx, qy, qz, wx, wy, wz;
+    // the state last written to the bodies, by slot
+    std::vector<double> x, y, z, vx, vy, vz, m;
+
+    bool inSync(const BodySoA& bodies) const
+    {
+        if (m.size() != bodies.size())
+            return false;
+        for (size_t i = 0; i < m.size(); i++) {
+            if ((float)x[i] != bodies.x[i] || (float)y[i] != bodies.y[i] || (float)z[i] != bodies.z[i]
+                || (float)vx[i] != bodies.vx[i] || (float)vy[i] != bodies.vy[i] || (float)vz[i] != bodies.vz[i]
+                || (float)m[i] != bodies.mass[i])
+                return false;
+        }
+        return true;
+    }
+
+    void prime(const BodySoA& bodies)
+    {
+        const size_t n = bodies.size();
+        x.assign(bodies.x.begin(), bodies.x.end());
+        y.assign(bodies.y.begin(), bodies.y.end());
+        z.assign(bodies.z.begin(), bodies.z.end());
+        vx.assign(bodies.vx.begin(), bodies.vx.end());
+        vy.assign(bodies.vy.begin(), bodies.vy.end());
+        vz.assign(bodies.vz.begin(), bodies.vz.end());
+        m.assign(bodies.mass.begin(), bodies.mass.end());
+        central = (int)(std::max_element(m.begin(), m.end()) - m.begin());
+
+        satellites.clear();
+        for (std::vector<double>* v : { &qx, &qy, &qz, &wx, &wy, &wz })
+            v->clear();
+        for (int i = 0; i < (int)n; i++) {
+            if (i == central)
+                continue;
+            satellites.push_back(i);
+            qx.push_back(x[i] - x[central]); qy.push_back(y[i] - y[central]); qz.push_back(z[i] - z[central]);
+            wx.push_back(vx[i] - vx[central]); wy.push_back(vy[i] - vy[central]); wz.push_back(vz[i] - vz[central]);
+        }
+        primed = true;
+    }
+};
+
+#endif
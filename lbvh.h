@@ -0,0 +1,350 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "body.h"
+#include "directsum.h"
+#include "threadpool.h"
+#include "morton.h"
+#include "barneshut.h"
+
+inline int leadingZeros64(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long bit;
+    return _BitScanReverse64(&bit, v) ? 63 - (int)bit : 64;
+#else
+    return v ? __builtin_clzll(v) : 64;
+#endif
+}
+
+struct LbvhTimings {
+    double keys = 0.0;        // bounding box and Morton keys
+    double sort = 0.0;        // radix sort and sorted body copy
+    double hierarchy = 0.0;   // one split per internal node
+    double moments = 0.0;     // bottom-up mass, centre of mass and bounds
+    double total = 0.0;
+};
+
+// Internal node of the radix tree. Children are internal nodes by index, or
+// single bodies as ~k with k their slot in Morton order. Every node covers
+// the slots [begin, begin + count); one cache line per node.
+struct alignas(64) LbvhNode {
+    glm::vec3 com;
+    float mass;
+    glm::vec3 lo;
+    int left;
+    glm::vec3 hi;
+    int right;
+    int begin;
+    int count;
+    int pad[2];
+};
+
+// Linear BVH built the Karras way (2012), with every phase parallel: bodies
+// are sorted by Morton key, each of the n - 1 internal nodes then finds its
+// own key range and split independently of the others, and moments are
+// gathered bottom-up with one walker per body, where the second walker to
+// reach a node combines its two children and carries on while the first one
+// stops. Node 0 is the root. The walk is the usual Barnes-Hut one, except
+// that the cell size is the longest side of a node's actual bounds, and
+// nodes holding at most leafSize bodies are summed directly.
+class LinearBvh
+{
+public:
+    AlignedVector<LbvhNode> nodes;
+    std::vector<int> order;             // body index of each Morton slot
+    AlignedVector<float> px, py, pz, pm; // positions and masses in Morton order
+    int leafSize = 8;
+    LbvhTimings timings;
+
+    void build(const BodySoA& bodies, ThreadPool& pool)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point start = Clock::now();
+        Clock::time_point mark = start;
+        auto lap = [&](double& slot) {
+            Clock::time_point now = Clock::now();
+            slot = std::chrono::duration<double, std::milli>(now - mark).count();
+            mark = now;
+        };
+
+        const size_t n = bodies.size();
+        timings = LbvhTimings();
+        nodes.clear();
+        sorter.sortKeys(bodies, pool);
+        order = sorter.order();
+
+        px.resize(n); py.resize(n); pz.resize(n); pm.resize(n);
+        pool.parallelFor(n, 16384, [&](size_t b, size_t e, int) {
+            for (size_t k = b; k < e; k++) {
+                const int i = order[k];
+                px[k] = bodies.x[i];
+                py[k] = bodies.y[i];
+                pz[k] = bodies.z[i];
+                pm[k] = bodies.mass[i];
+            }
+        });
+        lap(timings.sort);
+        timings.keys = sorter.keysMs;
+        timings.sort -= timings.keys;
+        if (n < 2)
+            return;
+
+        buildHierarchy(pool);
+        lap(timings.hierarchy);
+        computeMoments(pool);
+        lap(timings.moments);
+        timings.total = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // acceleration at Morton slot s, opening any node whose longest side is at
+    // least theta times its distance
+    glm::vec3 accelOnSlot(int s, float G, float theta) const
+    {
+        glm::vec3 acc(0.0f);
+        if (nodes.empty())
+            return acc;
+        const glm::vec3 p(px[s], py[s], pz[s]);
+        const float theta2 = theta * theta;
+
+        // depth is bounded by the 63 key bits plus the index bits used to
+        // split duplicate keys
+        int stack[128];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const int code = stack[--top];
+            if (code < 0) {
+                const int k = ~code;
+                if (k != s)
+                    acc += pairAccel(p, glm::vec3(px[k], py[k], pz[k]), pm[k], G);
+                continue;
+            }
+            const LbvhNode& node = nodes[code];
+            if (node.count <= leafSize) {
+                for (int k = node.begin; k < node.begin + node.count; k++) {
+                    if (k != s)
+                        acc += pairAccel(p, glm::vec3(px[k], py[k], pz[k]), pm[k], G);
+                }
+                continue;
+            }
+
+            const glm::vec3 ext = node.hi - node.lo;
+            const float size = std::max(ext.x, std::max(ext.y, ext.z));
+            const glm::vec3 dir = node.com - p;
+            const bool inside = glm::all(glm::greaterThanEqual(p, node.lo)) && glm::all(glm::lessThanEqual(p, node.hi));
+            if (size * size < theta2 * glm::dot(dir, dir) && !inside) {
+                acc += pairAccel(p, node.com, node.mass, G);
+            }
+            else {
+                stack[top++] = node.right;
+                stack[top++] = node.left;
+            }
+        }
+        return acc;
+    }
+
+    // total bytes held by the tree, the sorted body copy included
+    size_t memoryBytes() const
+    {
+        return nodes.capacity() * sizeof(LbvhNode) + order.capacity() * sizeof(int)
+            + (px.capacity() + py.capacity() + pz.capacity() + pm.capacity()) * sizeof(float)
+            + parent.capacity() * sizeof(int) + leafParent.capacity() * sizeof(int);
+    }
+
+private:
+    MortonSorter sorter;
+    std::vector<int> parent, leafParent;
+    std::unique_ptr<std::atomic<int>[]> visits;
+    size_t visitsSize = 0;
+
+    static glm::vec3 pairAccel(const glm::vec3& p, const glm::vec3& q, float mj, float G)
+    {
+        glm::vec3 dir = q - p;
+        float r2 = glm::dot(dir, dir) + SOFTENING;
+        return (G * mj / (r2 * std::sqrt(r2))) * dir;
+    }
+
+    // length of the common prefix of slots i and j; equal keys fall back on
+    // the slot numbers, so every key is distinct as far as the tree cares
+    int delta(const uint64_t* keys, int n, int i, int j) const
+    {
+        if (j < 0 || j >= n)
+            return -1;
+        if (keys[i] == keys[j])
+            return 64 + leadingZeros64((uint64_t)(uint32_t)(i ^ j)) - 32;
+        return leadingZeros64(keys[i] ^ keys[j]);
+    }
+
+    void buildHierarchy(ThreadPool& pool)
+    {
+        const int n = (int)order.size();
+        const uint64_t* keys = sorter.sortedKeys().data();
+        nodes.resize(n - 1);
+        parent.resize(n - 1);
+        leafParent.resize(n);
+        parent[0] = -1;
+
+        pool.parallelFor(n - 1, 4096, [&](size_t b, size_t e, int) {
+            for (size_t ni = b; ni < e; ni++) {
+                const int i = (int)ni;
+                // which way the range runs, and how far
+                const int d = delta(keys, n, i, i + 1) > delta(keys, n, i, i - 1) ? 1 : -1;
+                const int dmin = delta(keys, n, i, i - d);
+                int lmax = 2;
+                while (delta(keys, n, i, i + lmax * d) > dmin)
+                    lmax *= 2;
+                int l = 0;
+                for (int t = lmax / 2; t >= 1; t /= 2) {
+                    if (delta(keys, n, i, i + (l + t) * d) > dmin)
+                        l += t;
+                }
+                const int j = i + l * d;
+
+                // split: the last slot sharing more than the range's common prefix with i
+                const int dnode = delta(keys, n, i, j);
+                int s = 0;
+                for (int div = 2;; div *= 2) {
+                    const int t = (l + div - 1) / div;
+                    if (delta(keys, n, i, i + (s + t) * d) > dnode)
+                        s += t;
+                    if (t == 1)
+                        break;
+                }
+                const int gamma = i + s * d + std::min(d, 0);
+                const int first = std::min(i, j), last = std::max(i, j);
+
+                LbvhNode& node = nodes[i];
+                node.begin = first;
+                node.count = last - first + 1;
+                if (first == gamma) {
+                    node.left = ~gamma;
+                    leafParent[gamma] = i;
+                }
+                else {
+                    node.left = gamma;
+                    parent[gamma] = i;
+                }
+                if (last == gamma + 1) {
+                    node.right = ~(gamma + 1);
+                    leafParent[gamma + 1] = i;
+                }
+                else {
+                    node.right = gamma + 1;
+                    parent[gamma + 1] = i;
+                }
+            }
+        });
+    }
+
+    void computeMoments(ThreadPool& pool)
+    {
+        const int n = (int)order.size();
+        if (visitsSize < (size_t)n) {
+            visits.reset(new std::atomic<int>[n]);
+            visitsSize = n;
+        }
+        pool.parallelFor(n - 1, 16384, [&](size_t b, size_t e, int) {
+            for (size_t i = b; i < e; i++)
+                visits[i].store(0, std::memory_order_relaxed);
+        });
+
+        pool.parallelFor(n, 4096, [&](size_t b, size_t e, int) {
+            for (size_t k = b; k < e; k++) {
+                int node = leafParent[k];
+                // the first of the two children to arrive leaves the node to the second
+                while (node >= 0 && visits[node].fetch_add(1, std::memory_order_acq_rel) == 1) {
+                    combine(nodes[node]);
+                    node = parent[node];
+                }
+            }
+        });
+    }
+
+    void childMoments(int code, glm::vec3& com, float& mass, glm::vec3& lo, glm::vec3& hi) const
+    {
+        if (code < 0) {
+            const int k = ~code;
+            lo = hi = glm::vec3(px[k], py[k], pz[k]);
+            mass = pm[k];
+            com = lo;
+        }
+        else {
+            const LbvhNode& c = nodes[code];
+            com = c.com;
+            mass = c.mass;
+            lo = c.lo;
+            hi = c.hi;
+        }
+    }
+
+    void combine(LbvhNode& node) const
+    {
+        glm::vec3 comL, loL, hiL, comR, loR, hiR;
+        float massL, massR;
+        childMoments(node.left, comL, massL, loL, hiL);
+        childMoments(node.right, comR, massR, loR, hiR);
+        node.mass = massL + massR;
+        node.com = node.mass > 0.0f ? (massL * comL + massR * comR) / node.mass : 0.5f * (comL + comR);
+        node.lo = glm::min(loL, loR);
+        node.hi = glm::max(hiL, hiR);
+    }
+};
+
+// Walks are independent per body and go in Morton order, like the octree's.
+// With an active list only those bodies are updated.
+inline void computeAccelLbvh(LinearBvh& tree, BodySoA& bodies, float G, float theta, ThreadPool& pool,
+                             const std::vector<int>* active = nullptr)
+{
+    tree.build(bodies, pool);
+    const size_t n = bodies.size();
+    if (n < 2) {
+        bodies.zeroAcc();
+        return;
+    }
+    if (active) {
+        std::vector<int> slotOf(n);
+        for (size_t k = 0; k < n; k++)
+            slotOf[tree.order[k]] = (int)k;
+        pool.parallelFor(active->size(), 256, [&](size_t b, size_t e, int) {
+            for (size_t k = b; k < e; k++) {
+                const int i = (*active)[k];
+                glm::vec3 a = tree.accelOnSlot(slotOf[i], G, theta);
+                bodies.ax[i] = a.x;
+                bodies.ay[i] = a.y;
+                bodies.az[i] = a.z;
+            }
+        });
+        return;
+    }
+    pool.parallelFor(n, 256, [&](size_t b, size_t e, int) {
+        for (size_t k = b; k < e; k++) {
+            const int i = tree.order[k];
+            glm::vec3 a = tree.accelOnSlot((int)k, G, theta);
+            bodies.ax[i] = a.x;
+            bodies.ay[i] = a.y;
+            bodies.az[i] = a.z;
+        }
+    });
+}
+
+// LBVH accelerations for everyone, checked body for body against the direct sum
+inline ForceError measureLbvhError(const BodySoA& bodies, float G, float theta, ThreadPool& pool, int maxSamples = 1000)
+{
+    BodySoA copy = bodies;
+    LinearBvh tree;
+    computeAccelLbvh(tree, copy, G, theta, pool);
+    return measureForceErrorOf(bodies, G, [&](int i) { return copy.acc(i); }, maxSamples);
+}
+
+#endif
@@ -8,8 +8,27 @@
 #include <vector>
 #include <iostream>
 #include <random>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
 #include "camera.h"
 #include "shader.h"
+#include "instancering.h"
+#include "body.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+#include "initialconditions.h"
+#include "directsum.h"
+#include "barneshut.h"
+#include "physics.h"
+#include "integrator.h"
+#include "simulation.h"
+#include "simthread.h"
+#include "benchmark.h"
+#include "headless.h"
 
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
@@ -26,13 +45,6 @@ float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
-struct Body {
-    glm::vec3 pos;
-    glm::vec3 vel;
-    float mass;
-    glm::vec3 color;
-};
-
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
@@ -89,28 +101,129 @@ void processInput(GLFWwindow* window) {
         
 }
 
-void updatePhysics(std::vector<Body>& bodies, float dt, float Ga) {
-    const float G = Ga;
-    std::vector<glm::vec3> forces(bodies.size(), glm::vec3(0.0f));
-
-    for (size_t i = 0; i < bodies.size(); i++) {
-        for (size_t j = 0; j < bodies.size(); j++) {
-            if (i == j) continue;
-            glm::vec3 dir = bodies[j].pos - bodies[i].pos;
-            float dist = glm::length(dir);
-            float f = G * bodies[i].mass * bodies[j].mass / (dist * dist + 1e-5f);
-            forces[i] += f * glm::normalize(dir);
+int main(int argc, char** argv) {
+    int numBodies = NUMBODIES;
+    int numThreads = 0;
+    bool benchThreads = false;
+    bool benchBuild = false;
+    bool headless = false;
+    HeadlessOptions batch;
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--bodies" && a + 1 < argc)
+            numBodies = std::max(1, std::atoi(argv[++a]));
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--steps" && a + 1 < argc)
+            batch.steps = std::max(1LL, std::atoll(argv[++a]));
+        else if (arg == "--dt" && a + 1 < argc)
+            batch.dt = (float)std::atof(argv[++a]);
+        else if (arg == "--G" && a + 1 < argc)
+            batch.G = (float)std::atof(argv[++a]);
+        else if (arg == "--theta" && a + 1 < argc)
+            batch.theta = (float)std::atof(argv[++a]);
+        else if (arg == "--order" && a + 1 < argc)
+            batch.fmmOrder = std::atoi(argv[++a]);
+        else if (arg == "--grid" && a + 1 < argc)
+            batch.pmGrid = std::atoi(argv[++a]);
+        else if (arg == "--split" && a + 1 < argc)
+            batch.treepmSplit = (float)std::atof(argv[++a]);
+        else if (arg == "--no-refit")
+            batch.treeRefit = false;
+        else if (arg == "--quadrupole")
+            batch.treeQuadrupole = true;
+        else if (arg == "--group" && a + 1 < argc)
+            batch.treeGroupSize = std::max(0, std::atoi(argv[++a]));
+        else if (arg == "--sort" && a + 1 < argc)
+            batch.sortInterval = std::max(0, std::atoi(argv[++a]));
+        else if (arg == "--scene" && a + 1 < argc) {
+            std::string scene = argv[++a];
+            if (scene == "cube")
+                batch.scene = SCENE_CUBE;
+            else if (scene == "planets")
+                batch.scene = SCENE_PLANETS;
+            else
+                std::cerr << "Unknown scene " << scene << ", using cube\n";
+        }
+        else if (arg == "--tracers" && a + 1 < argc)
+            batch.tracers = std::max(0, std::atoi(argv[++a]));
+        else if (arg == "--seed" && a + 1 < argc)
+            batch.seed = (unsigned int)std::strtoul(argv[++a], NULL, 10);
+        else if (arg == "--output" && a + 1 < argc)
+            batch.output = argv[++a];
+        else if (arg == "--energy")
+            batch.energy = true;
+        else if (arg == "--solver" && a + 1 < argc) {
+            std::string solver = argv[++a];
+            if (solver == "direct")
+                batch.solver = SOLVER_DIRECT;
+            else if (solver == "pairwise")
+                batch.solver = SOLVER_DIRECT_PAIRWISE;
+            else if (solver == "bh")
+                batch.solver = SOLVER_BARNES_HUT;
+            else if (solver == "fmm")
+                batch.solver = SOLVER_FMM;
+            else if (solver == "pm")
+                batch.solver = SOLVER_PM;
+            else if (solver == "treepm")
+                batch.solver = SOLVER_TREEPM;
+            else if (solver == "lbvh")
+                batch.solver = SOLVER_LBVH;
+            else if (solver == "falcon")
+                batch.solver = SOLVER_FALCON;
+            else
+                std::cerr << "Unknown solver " << solver << ", using direct\n";
+        }
+        else if (arg == "--integrator" && a + 1 < argc) {
+            std::string integrator = argv[++a];
+            if (integrator == "leapfrog")
+                batch.integrator = INTEGRATOR_LEAPFROG;
+            else if (integrator == "euler")
+                batch.integrator = INTEGRATOR_EULER;
+            else if (integrator == "block")
+                batch.integrator = INTEGRATOR_BLOCK;
+            else if (integrator == "hermite")
+                batch.integrator = INTEGRATOR_HERMITE;
+            else if (integrator == "wh")
+                batch.integrator = INTEGRATOR_WISDOM_HOLMAN;
+            else if (integrator == "kepler")
+                batch.integrator = INTEGRATOR_KEPLER;
+            else if (integrator == "conics")
+                batch.integrator = INTEGRATOR_PATCHED_CONICS;
+            else
+                std::cerr << "Unknown integrator " << integrator << ", using leapfrog\n";
+        }
+        else if (arg == "--threads" && a + 1 < argc)
+            numThreads = std::atoi(argv[++a]);
+        else if (arg == "--bench-threads")
+            benchThreads = true;
+        else if (arg == "--bench-build")
+            benchBuild = true;
+        else if (arg == "--simd" && a + 1 < argc) {
+            std::string level = argv[++a];
+            for (int l = SIMD_SCALAR; l <= SIMD_AVX512; l++) {
+                if (level == simdLevelNames[l])
+                    setSimdLevel((SimdLevel)l);
+            }
         }
     }
-
-    for (size_t i = 0; i < bodies.size(); i++) {
-        glm::vec3 accel = forces[i] / bodies[i].mass;
-        bodies[i].vel += accel * dt;
-        bodies[i].pos += bodies[i].vel * dt;
+    std::cout << "Force kernel: " << simdLevelNames[activeSimdLevel()] << "\n";
+    if (benchThreads) {
+        runThreadScalingBenchmark(numBodies, numThreads);
+        return 0;
+    }
+    if (benchBuild) {
+        runTreeBuildBenchmark(numBodies, numThreads);
+        return 0;
+    }
+    ThreadPool pool(numThreads);
+    std::cout << "Worker threads: " << pool.size() << "\n";
+    // no window or GL context from here on: this is what runs on compute nodes
+    if (headless) {
+        batch.bodies = numBodies;
+        return runHeadless(batch, pool);
     }
-}
 
-int main() {
     // GLFW init
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -157,42 +270,45 @@ int main() {
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
-    unsigned int instanceVBO, colorVBO;
-    glGenBuffers(1, &instanceVBO);
-    glGenBuffers(1, &colorVBO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    BodySoA initial = makeScene(batch.scene, numBodies, std::random_device{}());
+    addTracers(initial, batch.scene, batch.tracers, std::random_device{}());
+    SimulationThread simThread(std::move(initial), pool);
+    // the tracers have been split off; they are drawn after the massive bodies
+    const BodySoA& massive = simThread.simulation().bodies;
+    const BodySoA& tracers = simThread.simulation().tracers;
+    const size_t bodyCount = massive.size();
+    const size_t instanceCount = bodyCount + tracers.size();
+    std::vector<glm::vec3> colors(massive.color.begin(), massive.color.end());
+    colors.insert(colors.end(), tracers.color.begin(), tracers.color.end());
+
+    // positions are rewritten whenever physics publishes, straight into mapped
+    // memory; the attribute pointer follows the ring slot being drawn
+    std::unique_ptr<InstanceRing> positionRing(new InstanceRing(instanceCount * sizeof(glm::vec3)));
+    glBindBuffer(GL_ARRAY_BUFFER, positionRing->id());
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(1);
     glVertexAttribDivisor(1, 1);
 
+    // colours never change, so they go up once into immutable storage
+    unsigned int colorVBO;
+    glGenBuffers(1, &colorVBO);
     glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
+    glBufferStorage(GL_ARRAY_BUFFER, instanceCount * sizeof(glm::vec3), colors.data(), 0);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(2);
     glVertexAttribDivisor(2, 1);
 
-
-    std::vector<Body> bodies;
-    bodies.reserve(NUMBODIES);
-
-    std::mt19937 rng(std::random_device{}());
-    std::uniform_real_distribution<float> distPos(-50.0f, 50.0f);
-    std::uniform_real_distribution<float> distVel(-0.1f, 0.1f);
-    std::uniform_real_distribution<float> distMass(0.5f, 2.0f);
-    std::uniform_real_distribution<float> distColor(0.0f, 1.0f);
-
-    for (int i = 0; i < NUMBODIES; i++) {
-        bodies.push_back({
-            glm::vec3(distPos(rng), distPos(rng), distPos(rng)),
-            glm::vec3(distVel(rng), distVel(rng), distVel(rng)),
-            distMass(rng),
-            glm::vec3(distColor(rng), distColor(rng), distColor(rng))
-            });
-    }
-
-    std::vector<glm::vec3> instancePositions(bodies.size());
-    std::vector<glm::vec3> instanceColors(bodies.size());
-
+    // the UI keeps its own copy of every setting and sends changes across
+    PhysicsSettings settings = simThread.simulation().gravity.settings;
+    float timeStep = simThread.simulation().dt;
+    int maxSubsteps = simThread.simulation().maxSubsteps;
+    int integrator = simThread.simulation().getIntegrator();
+    int sortInterval = simThread.simulation().sortInterval;
+    BlockTimestepLeapfrog blockDefaults;
+    float blockEta = blockDefaults.eta;
+    int blockMaxLevel = blockDefaults.maxLevel;
+    float hermiteEta = HermiteIntegrator().eta;
+    simThread.start();
 
     while (!glfwWindowShouldClose(window)) {
         float currentFrame = glfwGetTime();
@@ -201,6 +317,10 @@ int main() {
 
         processInput(window);
 
+        // never waits: if physics hasn't finished a step we draw the last one again
+        bool fresh = simThread.update();
+        const SimSnapshot& snap = simThread.latest();
+
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -209,27 +329,179 @@ int main() {
         ImGui::Begin("Simulation Controls", NULL, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize);
         float fps = 1.0f / deltaTime;
         ImGui::Text("FPS: %.1f", fps);
+        ImGui::Text("Force kernel: %s, %d threads", simdLevelNames[activeSimdLevel()], pool.size());
+        ImGui::Text("Physics: %.2f ms/step", snap.stepMs);
+        if (instanceCount > bodyCount)
+            ImGui::Text("%zu bodies + %zu massless tracers", bodyCount, instanceCount - bodyCount);
+
+        bool settingsChanged = ImGui::SliderFloat("Gravity G", &settings.G, 0.01f, 10.0f);
+        settingsChanged |= ImGui::Combo("Solver", &settings.solver, solverNames, IM_ARRAYSIZE(solverNames));
+        if (settings.solver == SOLVER_BARNES_HUT || settings.solver == SOLVER_FMM || settings.solver == SOLVER_TREEPM
+            || settings.solver == SOLVER_LBVH || settings.solver == SOLVER_FALCON) {
+            settingsChanged |= ImGui::SliderFloat("Opening angle", &settings.theta, 0.1f, 1.5f);
+            if (settings.solver == SOLVER_FMM) {
+                settingsChanged |= ImGui::SliderInt("Expansion order", &settings.fmmOrder, 1, 8);
+                const FmmTimings& t = snap.fmm;
+                ImGui::Text("FMM %.2f ms: build %.2f, up %.2f", t.total, t.build, t.upward);
+                ImGui::Text("  walk %.2f, M2L %.2f, down %.2f, near %.2f", t.traverse, t.m2l, t.downward, t.near);
+                ImGui::Text("  %lld M2L, %lld P2P cell pairs", t.m2lPairs, t.p2pPairs);
+            }
+            if (settings.solver == SOLVER_FALCON) {
+                settingsChanged |= ImGui::SliderInt("Expansion order", &settings.fmmOrder, 1, 8);
+                const FmmTimings& t = snap.falcon;
+                ImGui::Text("falcON %.2f ms: build %.2f, up %.2f", t.total, t.build, t.upward);
+                ImGui::Text("  mutual walk %.2f, down %.2f, L2P %.2f", t.traverse, t.downward, t.near);
+                ImGui::Text("  %lld M2L, %lld P2P mutual pairs", t.m2lPairs, t.p2pPairs);
+            }
+            if (settings.solver == SOLVER_BARNES_HUT) {
+                settingsChanged |= ImGui::Checkbox("Refit tree between rebuilds", &settings.treeRefit);
+                settingsChanged |= ImGui::Checkbox("Quadrupole moments", &settings.treeQuadrupole);
+                const TreeStats& t = snap.tree;
+                ImGui::Text("Tree %.2f ms (%s), %.0f bytes/body", t.lastMs, t.lastRebuilt ? "rebuilt" : "refitted",
+                    bodyCount > 0 ? (double)t.bytes / bodyCount : 0.0);
+                if (settings.treeRefit)
+                    ImGui::Text("  %d refits since rebuild, size x%.2f", t.refitsSinceBuild, t.inflation);
+                settingsChanged |= ImGui::SliderInt("Group size (0: per body)", &settings.treeGroupSize, 0, 256);
+                const GroupWalkStats& g = snap.groupWalk;
+                if (settings.treeGroupSize > 0 && g.groups > 0)
+                    ImGui::Text("  %lld groups, %.0f cells + %.0f bodies each", g.groups,
+                        (double)g.cells / g.groups, (double)g.particles / g.groups);
+            }
+            if (settings.solver == SOLVER_LBVH) {
+                const LbvhTimings& t = snap.lbvh;
+                ImGui::Text("LBVH build %.2f ms: keys %.2f, sort %.2f", t.total, t.keys, t.sort);
+                ImGui::Text("  hierarchy %.2f, moments %.2f", t.hierarchy, t.moments);
+            }
+            if (ImGui::Button("Check accuracy")) {
+                simThread.send([](Simulation& sim, SimDiagnostics& diag) {
+                    const PhysicsSettings& s = sim.gravity.settings;
+                    if (s.solver == SOLVER_FMM)
+                        diag.forceError = measureFmmError(sim.bodies, s.G, s.theta, s.fmmOrder, sim.pool());
+                    else if (s.solver == SOLVER_FALCON)
+                        diag.forceError = measureFalconError(sim.bodies, s.G, s.theta, s.fmmOrder, sim.pool());
+                    else if (s.solver == SOLVER_LBVH)
+                        diag.forceError = measureLbvhError(sim.bodies, s.G, s.theta, sim.pool());
+                    else if (s.solver == SOLVER_TREEPM)
+                        diag.forceError = measureTreePMError(sim.bodies, s.G, s.theta, s.pmGrid, s.treepmSplit, sim.pool());
+                    else if (s.solver == SOLVER_BARNES_HUT && s.treeGroupSize > 0)
+                        diag.forceError = measureGroupWalkError(sim.bodies, s.G, s.theta, s.treeQuadrupole, s.treeGroupSize, sim.pool());
+                    else
+                        diag.forceError = measureForceError(sim.bodies, s.G, s.theta, s.treeQuadrupole);
+                });
+            }
+            const ForceError& forceError = snap.diagnostics.forceError;
+            if (forceError.samples > 0) {
+                ImGui::Text("Rel. force error (%d bodies)", forceError.samples);
+                ImGui::Text("  mean %.2e  rms %.2e", forceError.mean, forceError.rms);
+                ImGui::Text("  99%% %.2e  max %.2e", forceError.p99, forceError.max);
+            }
+        }
+        if (settings.solver == SOLVER_PM || settings.solver == SOLVER_TREEPM) {
+            static const int grids[] = { 32, 64, 128, 256 };
+            static const char* const gridNames[] = { "32^3", "64^3", "128^3", "256^3" };
+            int g = 0;
+            while (g < 3 && grids[g] < settings.pmGrid)
+                g++;
+            if (ImGui::Combo("Mesh", &g, gridNames, IM_ARRAYSIZE(gridNames))) {
+                settings.pmGrid = grids[g];
+                settingsChanged = true;
+            }
+            if (settings.solver == SOLVER_TREEPM)
+                settingsChanged |= ImGui::SliderFloat("Split (cells)", &settings.treepmSplit, 0.5f, 4.0f);
+        }
+        if (settingsChanged) {
+            PhysicsSettings s = settings;
+            simThread.send([s](Simulation& sim, SimDiagnostics&) { sim.gravity.settings = s; });
+        }
 
+        if (ImGui::Combo("Integrator", &integrator, integratorNames, IM_ARRAYSIZE(integratorNames))) {
+            int type = integrator;
+            float eta = blockEta;
+            int maxLevel = blockMaxLevel;
+            float aarsethEta = hermiteEta;
+            simThread.send([type, eta, maxLevel, aarsethEta](Simulation& sim, SimDiagnostics&) {
+                sim.setIntegrator(type);
+                if (BlockTimestepLeapfrog* block = dynamic_cast<BlockTimestepLeapfrog*>(sim.integratorImpl())) {
+                    block->eta = eta;
+                    block->maxLevel = maxLevel;
+                }
+                if (HermiteIntegrator* hermite = dynamic_cast<HermiteIntegrator*>(sim.integratorImpl()))
+                    hermite->eta = aarsethEta;
+            });
+        }
+        bool stepChanged = ImGui::SliderFloat("Time step", &timeStep, 0.001f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic);
+        stepChanged |= ImGui::SliderInt("Max steps/frame", &maxSubsteps, 1, 32);
+        if (stepChanged) {
+            float dt = timeStep;
+            int cap = maxSubsteps;
+            simThread.send([dt, cap](Simulation& sim, SimDiagnostics&) {
+                sim.dt = dt;
+                sim.maxSubsteps = cap;
+            });
+        }
+        if (ImGui::SliderInt("Morton sort every", &sortInterval, 0, 256, sortInterval > 0 ? "%d steps" : "never")) {
+            int interval = sortInterval;
+            simThread.send([interval](Simulation& sim, SimDiagnostics&) { sim.sortInterval = interval; });
+        }
+        if (sortInterval > 0)
+            ImGui::Text("  last reorder %.2f ms", snap.sortMs);
+        if (integrator == INTEGRATOR_BLOCK) {
+            bool blockChanged = ImGui::SliderFloat("Timestep eta", &blockEta, 0.005f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+            blockChanged |= ImGui::SliderInt("Max level", &blockMaxLevel, 0, 12);
+            if (blockChanged) {
+                float eta = blockEta;
+                int maxLevel = blockMaxLevel;
+                simThread.send([eta, maxLevel](Simulation& sim, SimDiagnostics&) {
+                    if (BlockTimestepLeapfrog* block = dynamic_cast<BlockTimestepLeapfrog*>(sim.integratorImpl())) {
+                        block->eta = eta;
+                        block->maxLevel = maxLevel;
+                    }
+                });
+            }
+            if (bodyCount > 0 && !snap.levelCounts.empty()) {
+                ImGui::Text("Force evals/step: %lld (%.1f%% of shared dt_min)", snap.forceEvals,
+                    100.0 * snap.forceEvals / ((double)bodyCount * (1LL << (snap.levelCounts.size() - 1))));
+                for (size_t L = 0; L < snap.levelCounts.size(); L++) {
+                    if (snap.levelCounts[L] > 0)
+                        ImGui::Text("  level %d: %d bodies", (int)L, snap.levelCounts[L]);
+                }
+            }
+        }
+        if (integrator == INTEGRATOR_HERMITE) {
+            if (ImGui::SliderFloat("Aarseth eta", &hermiteEta, 0.001f, 0.2f, "%.3f", ImGuiSliderFlags_Logarithmic)) {
+                float eta = hermiteEta;
+                simThread.send([eta](Simulation& sim, SimDiagnostics&) {
+                    if (HermiteIntegrator* hermite = dynamic_cast<HermiteIntegrator*>(sim.integratorImpl()))
+                        hermite->eta = eta;
+                });
+            }
+            ImGui::Text("Direct-sum forces and jerks, whatever the solver");
+            ImGui::Text("  %d Hermite steps per step, last %.2e", snap.hermiteSteps, snap.hermiteStep);
+        }
+        if (integrator == INTEGRATOR_PATCHED_CONICS) {
+            ImGui::Text("Kepler orbits about the heaviest %d bodies, no forces", PatchedConics().maxAttractors);
+            ImGui::Text("  %lld sphere-of-influence crossings", snap.soiTransitions);
+        }
+        ImGui::Text("t = %.2f, %lld steps (%d last batch)", snap.time, snap.steps, snap.lastSubsteps);
 
-        static float G = 1.0f;
-
-        ImGui::SliderFloat("Gravity G", &G, 0.01f, 10.0f);
+        if (ImGui::Button("Measure energy")) {
+            simThread.send([](Simulation& sim, SimDiagnostics& diag) {
+                diag.energy = totalEnergy(sim.bodies, sim.gravity.settings.G, sim.pool());
+                if (diag.energy0 == 0.0)
+                    diag.energy0 = diag.energy;
+            });
+        }
+        const SimDiagnostics& diag = snap.diagnostics;
+        if (diag.energy0 != 0.0)
+            ImGui::Text("E = %.5g (drift %.2e)", diag.energy, (diag.energy - diag.energy0) / std::abs(diag.energy0));
 
         ImGui::End();
 
-        updatePhysics(bodies, deltaTime, G);
-
-        for (size_t i = 0; i < bodies.size(); i++) {
-            instancePositions[i] = bodies[i].pos;
-            instanceColors[i] = bodies[i].color;
+        if (fresh) {
+            void* dst = positionRing->beginWrite();
+            std::memcpy(dst, snap.positions.data(), snap.positions.size() * sizeof(glm::vec3));
         }
 
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, bodies.size() * sizeof(glm::vec3), instancePositions.data(), GL_DYNAMIC_DRAW);
-
-        glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-        glBufferData(GL_ARRAY_BUFFER, bodies.size() * sizeof(glm::vec3), instanceColors.data(), GL_DYNAMIC_DRAW);
-
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -242,7 +514,10 @@ int main() {
         pointShader.setMat4("projection", projection);
         pointShader.setMat4("view", view);
         glBindVertexArray(VAO);
-        glDrawArraysInstanced(GL_POINTS, 0, 1, bodies.size());
+        glBindBuffer(GL_ARRAY_BUFFER, positionRing->id());
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)positionRing->offset());
+        glDrawArraysInstanced(GL_POINTS, 0, 1, (GLsizei)snap.positions.size());
+        positionRing->endFrame();
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
@@ -250,6 +525,9 @@ int main() {
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+    simThread.stop();
+    positionRing.reset();
+    glDeleteBuffers(1, &colorVBO);
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
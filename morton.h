@@ -0,0 +1,179 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+
+// spreads the low 21 bits of v out to every third bit of a 63-bit word
+inline uint64_t spreadBits21(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+// 63-bit Z-order key of a point, 21 bits per axis, x in the top bit of each triple
+inline uint64_t mortonKey(uint32_t ix, uint32_t iy, uint32_t iz) {
+    return (spreadBits21(ix) << 2) | (spreadBits21(iy) << 1) | spreadBits21(iz);
+}
+
+// Reorders bodies along a Z-order curve over their bounding box, so bodies
+// that are close in space are close in memory too and tree walks and
+// neighbour loops stay in cache. Keys are sorted with a parallel LSD radix
+// sort, 8 bits per pass, where each chunk of the array counts its own digits
+// and then scatters into its slice of the output. Passes where every key
+// has the same digit are skipped, which for a cloud that only fills part
+// of its box is often the top one or two.
+class MortonSorter
+{
+public:
+    // wall time of the last sort, split into key generation, sorting and the
+    // gather of the body arrays
+    float lastMs = 0.0f, keysMs = 0.0f, sortMs = 0.0f, gatherMs = 0.0f;
+
+    // afterwards slot i holds the body that was in slot order()[i]
+    void sort(BodySoA& bodies, ThreadPool& pool)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point t0 = Clock::now();
+        sortKeys(bodies, pool);
+        bodies.permute(perm);
+        gatherMs = std::chrono::duration<float, std::milli>(Clock::now() - t0).count() - keysMs - sortMs;
+        lastMs = keysMs + sortMs + gatherMs;
+    }
+
+    // works out the order without moving anything: sortedKeys() ascending, and
+    // order()[k] the body each belongs to
+    void sortKeys(const BodySoA& bodies, ThreadPool& pool)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point t0 = Clock::now();
+        const size_t n = bodies.size();
+        perm.resize(n);
+        keys.resize(n);
+        gatherMs = 0.0f;
+        if (n < 2) {
+            for (size_t i = 0; i < n; i++) {
+                perm[i] = (int)i;
+                keys[i] = 0;
+            }
+            lastMs = keysMs = sortMs = 0.0f;
+            return;
+        }
+
+        makeKeys(bodies, pool);
+        const Clock::time_point t1 = Clock::now();
+        radixSort(pool);
+        const Clock::time_point t2 = Clock::now();
+        keysMs = std::chrono::duration<float, std::milli>(t1 - t0).count();
+        sortMs = std::chrono::duration<float, std::milli>(t2 - t1).count();
+        lastMs = keysMs + sortMs;
+    }
+
+    const std::vector<int>& order() const { return perm; }
+    const std::vector<uint64_t>& sortedKeys() const { return keys; }
+
+private:
+    static const int RADIX_BITS = 8;
+    static const int BUCKETS = 1 << RADIX_BITS;
+    static const size_t MIN_CHUNK = 16384;
+
+    std::vector<uint64_t> keys, keysTmp;
+    std::vector<int> perm, permTmp;
+    std::vector<size_t> counts;   // chunk-major, BUCKETS per chunk
+
+    void makeKeys(const BodySoA& bodies, ThreadPool& pool)
+    {
+        const size_t n = bodies.size();
+        const int workers = pool.size();
+        std::vector<glm::vec3> lo(workers, glm::vec3(1e30f)), hi(workers, glm::vec3(-1e30f));
+        pool.parallelFor(n, 16384, [&](size_t b, size_t e, int w) {
+            for (size_t i = b; i < e; i++) {
+                const glm::vec3 p = bodies.pos(i);
+                lo[w] = glm::min(lo[w], p);
+                hi[w] = glm::max(hi[w], p);
+            }
+        });
+        glm::vec3 boxLo = lo[0], boxHi = hi[0];
+        for (int w = 1; w < workers; w++) {
+            boxLo = glm::min(boxLo, lo[w]);
+            boxHi = glm::max(boxHi, hi[w]);
+        }
+        // a cube, so the curve has the same resolution along every axis
+        const glm::vec3 ext = boxHi - boxLo;
+        const float size = std::max(std::max(ext.x, ext.y), std::max(ext.z, 1e-20f));
+        const float scale = 2097151.0f / size;
+
+        pool.parallelFor(n, 16384, [&](size_t b, size_t e, int) {
+            for (size_t i = b; i < e; i++) {
+                const glm::vec3 q = (bodies.pos(i) - boxLo) * scale;
+                keys[i] = mortonKey((uint32_t)std::min(q.x, 2097151.0f), (uint32_t)std::min(q.y, 2097151.0f),
+                                    (uint32_t)std::min(q.z, 2097151.0f));
+                perm[i] = (int)i;
+            }
+        });
+    }
+
+    void radixSort(ThreadPool& pool)
+    {
+        const size_t n = keys.size();
+        const size_t chunks = std::max<size_t>(1, std::min<size_t>((size_t)pool.size() * 4, n / MIN_CHUNK));
+        const size_t chunkSize = (n + chunks - 1) / chunks;
+        keysTmp.resize(n);
+        permTmp.resize(n);
+        counts.resize(chunks * BUCKETS);
+
+        for (int shift = 0; shift < 63; shift += RADIX_BITS) {
+            std::fill(counts.begin(), counts.end(), 0);
+            pool.parallelFor(chunks, 1, [&](size_t b, size_t e, int) {
+                for (size_t c = b; c < e; c++) {
+                    size_t* count = &counts[c * BUCKETS];
+                    const size_t end = std::min(n, (c + 1) * chunkSize);
+                    for (size_t i = c * chunkSize; i < end; i++)
+                        count[(keys[i] >> shift) & (BUCKETS - 1)]++;
+                }
+            });
+
+            // exclusive scan, digit-major then chunk, so each chunk's share of
+            // a bucket follows the earlier chunks' and the sort stays stable
+            size_t sum = 0;
+            bool trivial = false;
+            for (int d = 0; d < BUCKETS; d++) {
+                size_t bucket = 0;
+                for (size_t c = 0; c < chunks; c++) {
+                    const size_t k = counts[c * BUCKETS + d];
+                    counts[c * BUCKETS + d] = sum;
+                    sum += k;
+                    bucket += k;
+                }
+                if (bucket == n)
+                    trivial = true;
+            }
+            if (trivial)
+                continue;
+
+            pool.parallelFor(chunks, 1, [&](size_t b, size_t e, int) {
+                for (size_t c = b; c < e; c++) {
+                    size_t* offset = &counts[c * BUCKETS];
+                    const size_t end = std::min(n, (c + 1) * chunkSize);
+                    for (size_t i = c * chunkSize; i < end; i++) {
+                        const size_t dst = offset[(keys[i] >> shift) & (BUCKETS - 1)]++;
+                        keysTmp[dst] = keys[i];
+                        permTmp[dst] = perm[i];
+                    }
+                }
+            });
+            keys.swap(keysTmp);
+            perm.swap(permTmp);
+        }
+    }
+};
+
+#endif
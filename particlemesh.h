@@ -0,0 +1,296 @@
+#ifndef PARTICLEMESH_H
+#define PARTICLEMESH_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "fft.h"
+
+// Particle-mesh gravity. Masses are spread onto a cubic grid over the bodies'
+// bounding box with cloud-in-cell weights, the potential is the grid
+// convolved with 1/r (by FFT, on a grid padded to twice the size so there are
+// no periodic images), the field is its four-point central difference, and each body
+// reads the field back with the same CIC weights. Cost is O(N + M^3 log M) for
+// an M^3 mesh, whatever the clustering, but forces are only good at distances
+// of a few cells and up: this is for big, fairly smooth distributions.
+//
+// Deposition is parallel without atomics: bodies are bucketed into x slabs two
+// cells thick, and a body only touches the planes of its own slab and the next
+// one, so all even slabs can be filled at once, then all odd ones.
+class ParticleMesh
+{
+public:
+    int gridSize = 64;   // cells per side, a power of two
+    // When positive, only the long-range part of gravity is computed: the
+    // mesh solves with erf(r / 2 r_s) / r, r_s being this many cells, and the
+    // CIC smoothing of deposit and readback is divided back out. This is the
+    // mesh half of TreePM.
+    float splitCells = 0.0f;
+
+    // accelerations for every body, or only for the listed ones
+    void compute(BodySoA& bodies, float G, ThreadPool& pool, const std::vector<int>* active = nullptr)
+    {
+        const size_t n = bodies.size();
+        if (n == 0)
+            return;
+        int ng = 8;
+        while (ng < gridSize && ng < 512)
+            ng <<= 1;
+        gridSize = ng;
+        prepare(ng, pool);
+
+        placeGrid(bodies, pool);
+        bucketBySlab(bodies);
+        deposit(bodies, pool);
+        solvePotential(pool);
+        differentiate(G, pool);
+        interpolate(bodies, pool, active);
+    }
+
+    float cellSize() const { return h; }
+
+private:
+    Fft3d fft;
+    int preparedFor = 0;
+    float preparedSplit = 0.0f;
+    std::vector<float> greenHat;        // transform of 1/r on the padded mesh, cell units
+    std::vector<cfloat> grid;           // padded mesh: mass in, potential out
+    std::vector<float> fieldX, fieldY, fieldZ;
+    std::vector<int> slabStart, slabBodies, slabOf;
+    glm::vec3 origin = glm::vec3(0.0f);
+    float h = 1.0f;
+
+    int padded() const { return 2 * gridSize; }
+    size_t gridIndex(int x, int y, int z) const { return ((size_t)x * padded() + y) * padded() + z; }
+
+    void prepare(int ng, ThreadPool& pool)
+    {
+        if (preparedFor == ng && preparedSplit == splitCells)
+            return;
+        preparedFor = ng;
+        preparedSplit = splitCells;
+        const int m = 2 * ng;
+        const size_t total = (size_t)m * m * m;
+        fft.init(m);
+        grid.assign(total, cfloat(0.0f, 0.0f));
+        fieldX.assign((size_t)ng * ng * ng, 0.0f);
+        fieldY.assign((size_t)ng * ng * ng, 0.0f);
+        fieldZ.assign((size_t)ng * ng * ng, 0.0f);
+
+        // 1/r between cells, measured the short way round the padded mesh; a
+        // cell's own mass is treated as one cell away
+        const float split = splitCells;
+        const double pi = 3.14159265358979323846;
+        pool.parallelFor(m, 1, [&](size_t b, size_t e, int) {
+            for (size_t x = b; x < e; x++) {
+                const int dx = std::min((int)x, m - (int)x);
+                for (int y = 0; y < m; y++) {
+                    const int dy = std::min(y, m - y);
+                    for (int z = 0; z < m; z++) {
+                        const int dz = std::min(z, m - z);
+                        const double r = std::sqrt((double)(dx * dx + dy * dy + dz * dz));
+                        double g;
+                        if (split > 0.0f)
+                            g = r > 0.0 ? std::erf(r / (2.0 * split)) / r : 1.0 / (std::sqrt(pi) * split);
+                        else
+                            g = r > 0.0 ? 1.0 / r : 1.0;
+                        grid[(x * m + y) * m + z] = cfloat((float)g, 0.0f);
+                    }
+                }
+            }
+        });
+        fft.forward(grid, pool);
+        // real and even, so the transform is real
+        greenHat.resize(total);
+        for (size_t i = 0; i < total; i++)
+            greenHat[i] = grid[i].real();
+
+        if (split > 0.0f) {
+            // CIC window per axis is sinc^2(k/2); deposit and readback both apply it
+            std::vector<double> window(m);
+            for (int i = 0; i < m; i++) {
+                const int f = std::min(i, m - i);
+                const double arg = pi * f / m;
+                const double sinc = f == 0 ? 1.0 : std::sin(arg) / arg;
+                window[i] = sinc * sinc;
+            }
+            pool.parallelFor(m, 1, [&](size_t b, size_t e, int) {
+                for (size_t x = b; x < e; x++)
+                    for (int y = 0; y < m; y++)
+                        for (int z = 0; z < m; z++) {
+                            const double w = window[x] * window[y] * window[z];
+                            greenHat[(x * m + y) * m + z] = (float)(greenHat[(x * m + y) * m + z] / (w * w));
+                        }
+            });
+        }
+    }
+
+    // cubic cells over the bounding box, with half a cell of margin so CIC
+    // never reaches past the last plane
+    void placeGrid(const BodySoA& bodies, ThreadPool& pool)
+    {
+        const size_t n = bodies.size();
+        std::vector<glm::vec3> lo(pool.size(), bodies.pos(0)), hi(pool.size(), bodies.pos(0));
+        pool.parallelFor(n, 16384, [&](size_t b, size_t e, int worker) {
+            for (size_t i = b; i < e; i++) {
+                lo[worker] = glm::min(lo[worker], bodies.pos(i));
+                hi[worker] = glm::max(hi[worker], bodies.pos(i));
+            }
+        });
+        glm::vec3 boxLo = lo[0], boxHi = hi[0];
+        for (int w = 1; w < pool.size(); w++) {
+            boxLo = glm::min(boxLo, lo[w]);
+            boxHi = glm::max(boxHi, hi[w]);
+        }
+        glm::vec3 extent = boxHi - boxLo;
+        float size = std::max(extent.x, std::max(extent.y, extent.z));
+        size = size * 1.001f + 1e-6f;
+        h = size / (float)(gridSize - 2);
+        origin = boxLo - glm::vec3(0.5f * h);
+    }
+
+    // grid coordinate of a body along one axis, with cell centres on integers
+    float cellCoord(float p, float o) const { return (p - o) / h; }
+
+    void bucketBySlab(const BodySoA& bodies)
+    {
+        const size_t n = bodies.size();
+        const int slabs = gridSize / 2;
+        slabStart.assign(slabs + 1, 0);
+        slabOf.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            int x0 = (int)cellCoord(bodies.x[i], origin.x);
+            int s = std::min(std::max(x0, 0), gridSize - 2) / 2;
+            slabOf[i] = s;
+            slabStart[s + 1]++;
+        }
+        for (int s = 0; s < slabs; s++)
+            slabStart[s + 1] += slabStart[s];
+        std::vector<int> cursor(slabStart.begin(), slabStart.end() - 1);
+        slabBodies.resize(n);
+        for (size_t i = 0; i < n; i++)
+            slabBodies[cursor[slabOf[i]]++] = (int)i;
+    }
+
+    // CIC weights: the two cells either side of u along an axis
+    void cicWeights(float u, int& i0, float& w1) const
+    {
+        u = std::min(std::max(u, 0.0f), (float)(gridSize - 1) - 1e-4f);
+        i0 = std::min((int)u, gridSize - 2);
+        w1 = u - (float)i0;
+    }
+
+    void deposit(const BodySoA& bodies, ThreadPool& pool)
+    {
+        const size_t total = grid.size();
+        pool.parallelFor(total, 65536, [&](size_t b, size_t e, int) {
+            std::fill(grid.begin() + b, grid.begin() + e, cfloat(0.0f, 0.0f));
+        });
+
+        const int slabs = gridSize / 2;
+        for (int colour = 0; colour < 2; colour++) {
+            pool.parallelFor((slabs - colour + 1) / 2, 1, [&](size_t b, size_t e, int) {
+                for (size_t k = b; k < e; k++) {
+                    const int s = 2 * (int)k + colour;
+                    for (int q = slabStart[s]; q < slabStart[s + 1]; q++) {
+                        const int i = slabBodies[q];
+                        int x0, y0, z0;
+                        float fx, fy, fz;
+                        cicWeights(cellCoord(bodies.x[i], origin.x), x0, fx);
+                        cicWeights(cellCoord(bodies.y[i], origin.y), y0, fy);
+                        cicWeights(cellCoord(bodies.z[i], origin.z), z0, fz);
+                        const float m = bodies.mass[i];
+                        const float wx[2] = { 1.0f - fx, fx }, wy[2] = { 1.0f - fy, fy }, wz[2] = { 1.0f - fz, fz };
+                        for (int a = 0; a < 2; a++)
+                            for (int c = 0; c < 2; c++)
+                                for (int d = 0; d < 2; d++)
+                                    grid[gridIndex(x0 + a, y0 + c, z0 + d)] += cfloat(m * wx[a] * wy[c] * wz[d], 0.0f);
+                    }
+                }
+            });
+        }
+    }
+
+    void solvePotential(ThreadPool& pool)
+    {
+        // mass only sits in the first gridSize^3 corner, and the field only
+        // needs the potential there plus two cells either side
+        fft.forward(grid, pool, gridSize);
+        pool.parallelFor(grid.size(), 65536, [&](size_t b, size_t e, int) {
+            for (size_t i = b; i < e; i++)
+                grid[i] *= greenHat[i];
+        });
+        fft.inverse(grid, pool, gridSize + 2, 2);
+    }
+
+    // a = -grad(phi) with phi = -G/h sum m / |n|, by the fourth-order central
+    // difference (8 (phi[+1] - phi[-1]) - (phi[+2] - phi[-2])) / 12; the padded
+    // mesh holds valid potential two cells outside the mass grid too
+    void differentiate(float G, ThreadPool& pool)
+    {
+        const int ng = gridSize;
+        const int m = padded();
+        const float scale = G / (12.0f * h * h);
+        auto phi = [&](int x, int y, int z) { return grid[gridIndex((x + m) % m, (y + m) % m, (z + m) % m)].real(); };
+        pool.parallelFor(ng, 1, [&](size_t b, size_t e, int) {
+            for (size_t xs = b; xs < e; xs++) {
+                const int x = (int)xs;
+                for (int y = 0; y < ng; y++) {
+                    for (int z = 0; z < ng; z++) {
+                        const size_t out = ((size_t)x * ng + y) * ng + z;
+                        fieldX[out] = scale * (8.0f * (phi(x + 1, y, z) - phi(x - 1, y, z)) - (phi(x + 2, y, z) - phi(x - 2, y, z)));
+                        fieldY[out] = scale * (8.0f * (phi(x, y + 1, z) - phi(x, y - 1, z)) - (phi(x, y + 2, z) - phi(x, y - 2, z)));
+                        fieldZ[out] = scale * (8.0f * (phi(x, y, z + 1) - phi(x, y, z - 1)) - (phi(x, y, z + 2) - phi(x, y, z - 2)));
+                    }
+                }
+            }
+        });
+    }
+
+    void interpolateOne(BodySoA& bodies, int i) const
+    {
+        const int ng = gridSize;
+        int x0, y0, z0;
+        float fx, fy, fz;
+        cicWeights(cellCoord(bodies.x[i], origin.x), x0, fx);
+        cicWeights(cellCoord(bodies.y[i], origin.y), y0, fy);
+        cicWeights(cellCoord(bodies.z[i], origin.z), z0, fz);
+        const float wx[2] = { 1.0f - fx, fx }, wy[2] = { 1.0f - fy, fy }, wz[2] = { 1.0f - fz, fz };
+        float ax = 0.0f, ay = 0.0f, az = 0.0f;
+        for (int a = 0; a < 2; a++) {
+            for (int c = 0; c < 2; c++) {
+                for (int d = 0; d < 2; d++) {
+                    const size_t k = ((size_t)(x0 + a) * ng + (y0 + c)) * ng + (z0 + d);
+                    const float w = wx[a] * wy[c] * wz[d];
+                    ax += w * fieldX[k];
+                    ay += w * fieldY[k];
+                    az += w * fieldZ[k];
+                }
+            }
+        }
+        bodies.ax[i] = ax;
+        bodies.ay[i] = ay;
+        bodies.az[i] = az;
+    }
+
+    void interpolate(BodySoA& bodies, ThreadPool& pool, const std::vector<int>* active) const
+    {
+        if (active) {
+            pool.parallelFor(active->size(), 4096, [&](size_t b, size_t e, int) {
+                for (size_t k = b; k < e; k++)
+                    interpolateOne(bodies, (*active)[k]);
+            });
+        }
+        else {
+            pool.parallelFor(bodies.size(), 4096, [&](size_t b, size_t e, int) {
+                for (size_t i = b; i < e; i++)
+                    interpolateOne(bodies, (int)i);
+            });
+        }
+    }
+};
+
+#endif
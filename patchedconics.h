@@ -0,0 +1,442 @@
+#ifndef PATCHEDCONICS_H
+#define PATCHEDCONICS_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "integrator.h"
+#include "kepler.h"
+#include "tracers.h"
+
+// Patched conics: no forces at all. Every body follows a Kepler orbit about
+// one primary, G m_primary and nothing else, and changes primary where it
+// crosses a sphere of influence. Only the heaviest maxAttractors bodies can
+// be primaries. The heaviest of them is the root: it coasts in a straight
+// line and its sphere of influence is everything. Each other attractor's
+// sphere has the Laplace radius a (m / M)^(2/5), with a the semi-major axis
+// of its orbit about its own primary M (or its distance, on an open orbit).
+//
+// A step drifts every body along its conic with the batched Kepler solver,
+// grouped by primary, then checks whether it ended outside its primary's
+// sphere or inside that of another attractor orbiting the same primary.
+// Bodies that did are stepped again from the start: the crossing time is
+// found by regula falsi on the distance to the sphere's edge, with the
+// attractors moving on their own conics, and the body is handed over to the
+// new primary there and drifted for the rest of the step. A body can only
+// have a primary heavier than itself. The cost is O(N) drifts plus a check
+// of each body against the attractors around its primary, and the result
+// doesn't depend on dt except through which crossings get noticed: a body
+// that passes right through a sphere within one step is missed. Massless
+// tracers follow Kepler orbits about the root and don't change primary.
+class PatchedConics : public Integrator
+{
+public:
+    int maxAttractors = 32;
+
+    bool movesTracers() const override { return true; }
+    // primary changes in the last call and since the last reset
+    int lastTransitions = 0;
+    long long totalTransitions = 0;
+    // drifts in the last call that Kepler's equation couldn't be solved for
+    // (a body on top of its primary) and were done in a straight line
+    int lastKeplerFailures = 0;
+
+    void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) override
+    {
+        (void)accel;
+        if (bodies.size() == 0)
+            return;
+        if (!primed || !inSync(bodies))
+            prime(bodies);
+        const double h = dt;
+        start = rel;
+        startPrimary = primary;
+        startSoi = soi;
+        moons.assign(attractors.size(), std::vector<int>());
+        for (int c : attractors) {
+            if (primary[c] >= 0)
+                moons[rank[primary[c]]].push_back(c);
+        }
+
+        driftAll(h, pool);
+        absolutes();
+        auto end = [this](int c) { return abs[c].pos; };
+
+        // bodies whose end state is across a sphere of influence
+        std::vector<char> crossed(m.size(), 0);
+        pool.parallelFor(m.size(), 4096, [&](size_t b, size_t e, int) {
+            for (size_t i = b; i < e; i++)
+                crossed[i] = primary[i] >= 0 && crossing((int)i, abs[i].pos, rel[i].pos, primary[i], end) != -2;
+        });
+        // attractors first, in order of mass, then the rest
+        lastTransitions = 0;
+        for (int c : attractors) {
+            if (crossed[c])
+                lastTransitions += resolve(c, h);
+        }
+        for (size_t i = 0; i < m.size(); i++) {
+            if (crossed[i] && rank[i] < 0)
+                lastTransitions += resolve((int)i, h);
+        }
+        totalTransitions += lastTransitions;
+        if (lastTransitions > 0)
+            absolutes();
+        for (int c : attractors)
+            soi[c] = sphereOfInfluence(c);
+        writeBack(bodies);
+
+        // tracers stay on Kepler orbits about the root, which coasts
+        if (tracers && !tracers->empty() && !attractors.empty()) {
+            const int root = attractors[0];
+            lastKeplerFailures += keplerDriftTracers(*tracers, mu(root), h, start[root].pos, start[root].vel,
+                                                     abs[root].pos, abs[root].vel, pool);
+        }
+    }
+
+    void reset() override
+    {
+        primed = false;
+        totalTransitions = 0;
+    }
+
+    void reorder(const std::vector<int>& perm) override
+    {
+        if (!primed || m.size() != perm.size())
+            return;
+        std::vector<int> slot(perm.size());
+        for (size_t i = 0; i < perm.size(); i++)
+            slot[perm[i]] = (int)i;
+        permute(m, perm);
+        permute(rel, perm);
+        permute(abs, perm);
+        permute(soi, perm);
+        permute(rank, perm);
+        permute(primary, perm);
+        for (int& p : primary) {
+            if (p >= 0)
+                p = slot[p];
+        }
+        for (int& c : attractors)
+            c = slot[c];
+    }
+
+private:
+    struct State {
+        glm::dvec3 pos, vel;
+    };
+
+    bool primed = false;
+    std::vector<double> m;
+    // primary by slot (-1 for the root, which moves in a straight line) and
+    // the state relative to it; the root's is its absolute state
+    std::vector<int> primary;
+    std::vector<State> rel;
+    // absolute states, the last ones written to the bodies
+    std::vector<State> abs;
+    // attractor slots, heaviest first; rank[i] is i's place among them or -1
+    std::vector<int> attractors, rank;
+    std::vector<double> soi;
+    // the same at the start of the step, which the crossings are searched from
+    std::vector<int> startPrimary;
+    std::vector<State> start;
+    std::vector<double> startSoi;
+    // by rank, the attractors orbiting each attractor at the start of the step
+    std::vector<std::vector<int>> moons;
+    // bodies grouped by primary for the batched drift
+    std::vector<int> grouped, groupStart;
+    std::vector<double> gx, gy, gz, gvx, gvy, gvz;
+
+    template <typename T>
+    static void permute(std::vector<T>& v, const std::vector<int>& perm)
+    {
+        std::vector<T> out(v.size());
+        for (size_t i = 0; i < perm.size(); i++)
+            out[i] = v[perm[i]];
+        v.swap(out);
+    }
+
+    double mu(int p) const { return G * m[p]; }
+
+    // s drifted by t on a conic about mu, in a straight line if that fails
+    static State conic(State s, double mu, double t)
+    {
+        if (t == 0.0)
+            return s;
+        if (!keplerDrift(mu, t, s.pos.x, s.pos.y, s.pos.z, s.vel.x, s.vel.y, s.vel.z))
+            s.pos += s.vel * t;
+        return s;
+    }
+
+    // absolute state of attractor c a time t into the step, as it moved
+    // before any crossings were handled
+    State attractorAt(int c, double t) const
+    {
+        const int p = startPrimary[c];
+        if (p < 0)
+            return { start[c].pos + start[c].vel * t, start[c].vel };
+        const State a = attractorAt(p, t);
+        const State r = conic(start[c], mu(p), t);
+        return { a.pos + r.pos, a.vel + r.vel };
+    }
+
+    bool mayOrbit(int i, int c) const { return c != i && (rank[i] < 0 || rank[c] < rank[i]); }
+
+    // Which way body i at absolute position p, relative position r to its
+    // primary q, has crossed: -1 out of q's sphere, an attractor's slot for
+    // into that one's, -2 for neither. where(c) is attractor c's position at
+    // the same time. The edges have a little slack so a body handed over
+    // right on one isn't handed straight back.
+    template <typename Where>
+    int crossing(int i, const glm::dvec3& p, const glm::dvec3& r, int q, const Where& where) const
+    {
+        const double out = 1.0 + 1e-6, in = 1.0 - 1e-6;
+        if (startPrimary[q] >= 0 && glm::dot(r, r) > startSoi[q] * startSoi[q] * out * out)
+            return -1;
+        for (int c : moons[rank[q]]) {
+            const glm::dvec3 d = p - where(c);
+            if (mayOrbit(i, c) && glm::dot(d, d) < startSoi[c] * startSoi[c] * in * in)
+                return c;
+        }
+        return -2;
+    }
+
+    // Steps body i again from the start of the step, switching primary at
+    // every crossing it makes, and returns how many it made.
+    int resolve(int i, double h)
+    {
+        int q = startPrimary[i];
+        State s = start[i];
+        double t0 = 0.0;
+        int switches = 0;
+        for (; switches < 4; switches++) {
+            const State r1 = conic(s, mu(q), h - t0);
+            const glm::dvec3 p1 = attractorAt(q, h).pos + r1.pos;
+            const int to = crossing(i, p1, r1.pos, q, [&](int c) { return attractorAt(c, h).pos; });
+            if (to == -2)
+                break;
+            const int next = to == -1 ? startPrimary[q] : to;
+            const double edge = to == -1 ? startSoi[q] : startSoi[to];
+            // signed distance past the sphere's edge a time t into the step
+            auto past = [&](double t) {
+                const State r = conic(s, mu(q), t - t0);
+                if (to == -1)
+                    return glm::length(r.pos) - edge;
+                return edge - glm::length(attractorAt(q, t).pos + r.pos - attractorAt(to, t).pos);
+            };
+            const double t = crossingTime(past, t0, h, edge);
+            const State r = conic(s, mu(q), t - t0);
+            const State a = attractorAt(q, t), b = attractorAt(next, t);
+            s = { a.pos + r.pos - b.pos, a.vel + r.vel - b.vel };
+            q = next;
+            t0 = t;
+        }
+        rel[i] = conic(s, mu(q), h - t0);
+        primary[i] = q;
+        return switches;
+    }
+
+    // First time in [t0, t1] at which past() goes from negative (not across)
+    // to positive. It is sampled at a few points for a bracket, which also
+    // finds the way out of a sphere the body was only just handed into, and
+    // the bracket is closed by regula falsi with the Illinois tweak. With no
+    // bracket to be found the crossing is taken to be at t0.
+    template <typename F>
+    static double crossingTime(const F& past, double t0, double t1, double scale)
+    {
+        const int samples = 8;
+        double a = t0, fa = past(t0), b = t1, fb = 0.0;
+        bool bracketed = false;
+        for (int k = 1; k <= samples && !bracketed; k++) {
+            const double t = t0 + (t1 - t0) * k / samples;
+            const double f = past(t);
+            if (fa < 0.0 && f > 0.0) {
+                b = t;
+                fb = f;
+                bracketed = true;
+            }
+            else if (f < 0.0 || fa >= 0.0) {
+                a = t;
+                fa = f;
+            }
+        }
+        if (!bracketed)
+            return t0;
+        int side = 0;
+        for (int it = 0; it < 100; it++) {
+            const double c = (a * fb - b * fa) / (fb - fa);
+            const double fc = past(c);
+            if (std::abs(fc) <= 1e-12 * scale || b - a <= 1e-12 * std::abs(b))
+                return c;
+            if (fc > 0.0) {
+                b = c;
+                fb = fc;
+                if (side == 1)
+                    fa *= 0.5;
+                side = 1;
+            }
+            else {
+                a = c;
+                fa = fc;
+                if (side == -1)
+                    fb *= 0.5;
+                side = -1;
+            }
+        }
+        return 0.5 * (a + b);
+    }
+
+    // every body along its conic, a primary's worth at a time
+    void driftAll(double h, ThreadPool& pool)
+    {
+        const size_t n = m.size(), na = attractors.size();
+        groupStart.assign(na + 1, 0);
+        for (size_t i = 0; i < n; i++) {
+            if (primary[i] >= 0)
+                groupStart[rank[primary[i]] + 1]++;
+        }
+        for (size_t k = 0; k < na; k++)
+            groupStart[k + 1] += groupStart[k];
+        grouped.resize(groupStart[na]);
+        std::vector<int> fill(groupStart.begin(), groupStart.end() - 1);
+        for (size_t i = 0; i < n; i++) {
+            if (primary[i] >= 0)
+                grouped[fill[rank[primary[i]]]++] = (int)i;
+        }
+        const size_t ng = grouped.size();
+        for (std::vector<double>* v : { &gx, &gy, &gz, &gvx, &gvy, &gvz })
+            v->resize(ng);
+        for (size_t k = 0; k < ng; k++) {
+            const State& s = rel[grouped[k]];
+            gx[k] = s.pos.x; gy[k] = s.pos.y; gz[k] = s.pos.z;
+            gvx[k] = s.vel.x; gvy[k] = s.vel.y; gvz[k] = s.vel.z;
+        }
+
+        lastKeplerFailures = 0;
+        for (size_t a = 0; a < na; a++) {
+            const size_t first = groupStart[a], count = groupStart[a + 1] - first;
+            lastKeplerFailures += keplerDriftParallel(G * m[attractors[a]], h, count, &gx[first], &gy[first], &gz[first],
+                                                      &gvx[first], &gvy[first], &gvz[first], pool);
+        }
+
+        for (size_t k = 0; k < ng; k++)
+            rel[grouped[k]] = { glm::dvec3(gx[k], gy[k], gz[k]), glm::dvec3(gvx[k], gvy[k], gvz[k]) };
+        for (size_t i = 0; i < n; i++) {
+            if (primary[i] < 0)
+                rel[i].pos += rel[i].vel * h;
+        }
+    }
+
+    // absolute states from the relative ones; primaries are heavier than what
+    // orbits them, so attractors in order of mass have theirs ready
+    void absolutes()
+    {
+        for (int c : attractors)
+            abs[c] = absolute(c);
+        for (size_t i = 0; i < m.size(); i++) {
+            if (rank[i] < 0)
+                abs[i] = absolute((int)i);
+        }
+    }
+
+    State absolute(int i) const
+    {
+        const int p = primary[i];
+        if (p < 0)
+            return rel[i];
+        return { abs[p].pos + rel[i].pos, abs[p].vel + rel[i].vel };
+    }
+
+    double sphereOfInfluence(int c) const
+    {
+        const int p = primary[c];
+        if (p < 0)
+            return std::numeric_limits<double>::infinity();
+        if (m[p] <= 0.0)
+            return 0.0;
+        const double r = glm::length(rel[c].pos);
+        const double beta = 2.0 * mu(p) / r - glm::dot(rel[c].vel, rel[c].vel);
+        const double a = beta > 0.0 ? mu(p) / beta : r;
+        return a * std::pow(m[c] / m[p], 0.4);
+    }
+
+    void writeBack(BodySoA& bodies) const
+    {
+        for (size_t i = 0; i < m.size(); i++) {
+            bodies.x[i] = (float)abs[i].pos.x; bodies.y[i] = (float)abs[i].pos.y; bodies.z[i] = (float)abs[i].pos.z;
+            bodies.vx[i] = (float)abs[i].vel.x; bodies.vy[i] = (float)abs[i].vel.y; bodies.vz[i] = (float)abs[i].vel.z;
+        }
+    }
+
+    bool inSync(const BodySoA& bodies) const
+    {
+        if (m.size() != bodies.size())
+            return false;
+        for (size_t i = 0; i < m.size(); i++) {
+            const State& s = abs[i];
+            if ((float)s.pos.x != bodies.x[i] || (float)s.pos.y != bodies.y[i] || (float)s.pos.z != bodies.z[i]
+                || (float)s.vel.x != bodies.vx[i] || (float)s.vel.y != bodies.vy[i] || (float)s.vel.z != bodies.vz[i]
+                || (float)m[i] != bodies.mass[i])
+                return false;
+        }
+        return true;
+    }
+
+    // Takes over the bodies' state. Attractors pick their primary heaviest
+    // first, so the spheres they might fall in are known by then; every body
+    // goes to the smallest sphere it is inside.
+    void prime(const BodySoA& bodies)
+    {
+        const size_t n = bodies.size();
+        m.assign(bodies.mass.begin(), bodies.mass.end());
+        abs.resize(n);
+        for (size_t i = 0; i < n; i++)
+            abs[i] = { glm::dvec3(bodies.pos(i)), glm::dvec3(bodies.vel(i)) };
+
+        attractors.clear();
+        for (size_t i = 0; i < n; i++) {
+            if (m[i] > 0.0)
+                attractors.push_back((int)i);
+        }
+        std::stable_sort(attractors.begin(), attractors.end(), [&](int a, int b) { return m[a] > m[b]; });
+        if ((int)attractors.size() > maxAttractors)
+            attractors.resize(std::max(1, maxAttractors));
+        rank.assign(n, -1);
+        for (size_t k = 0; k < attractors.size(); k++)
+            rank[attractors[k]] = (int)k;
+
+        primary.assign(n, -1);
+        rel = abs;
+        soi.assign(n, 0.0);
+        startPrimary = primary;
+        for (int c : attractors) {
+            adopt(c);
+            soi[c] = sphereOfInfluence(c);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (rank[i] < 0)
+                adopt((int)i);
+        }
+        primed = true;
+    }
+
+    void adopt(int i)
+    {
+        int best = -1;
+        for (int c : attractors) {
+            if (!mayOrbit(i, c))
+                continue;
+            if (glm::length(abs[i].pos - abs[c].pos) < soi[c] && (best < 0 || soi[c] < soi[best]))
+                best = c;
+        }
+        primary[i] = best;
+        rel[i] = abs[i];
+        if (best >= 0)
+            rel[i] = { abs[i].pos - abs[best].pos, abs[i].vel - abs[best].vel };
+    }
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "directsum.h"
+#include "barneshut.h"
+#include "fmm.h"
+#include "falcon.h"
+#include "particlemesh.h"
+#include "treepm.h"
+#include "lbvh.h"
+#include "groupwalk.h"
+#include "tracers.h"
+
+enum Solver {
+    SOLVER_DIRECT,
+    SOLVER_DIRECT_PAIRWISE,
+    SOLVER_BARNES_HUT,
+    SOLVER_FMM,
+    SOLVER_PM,
+    SOLVER_TREEPM,
+    SOLVER_LBVH,
+    SOLVER_FALCON
+};
+const char* const solverNames[] = { "Direct sum", "Direct sum (pairwise)", "Barnes-Hut", "Fast multipole", "Particle mesh", "TreePM",
+    "Barnes-Hut (LBVH)", "Dual tree (falcON)" };
+
+struct PhysicsSettings {
+    float G = 1.0f;
+    int solver = SOLVER_DIRECT;
+    float theta = 0.5f;     // opening angle for the tree solvers, FMM and TreePM
+    int fmmOrder = 4;       // expansion order of the FMM and falcON
+    int pmGrid = 64;        // particle-mesh cells per side, a power of two
+    float treepmSplit = 1.5f; // TreePM split radius r_s, in mesh cells
+    bool treeRefit = true;  // Barnes-Hut refits its octree between rebuilds
+    bool treeQuadrupole = false; // Barnes-Hut cells carry quadrupole moments
+    int treeGroupSize = 64; // Barnes-Hut walks once per group of this many bodies; 0 walks per body
+
+    bool operator==(const PhysicsSettings& o) const
+    {
+        return G == o.G && solver == o.solver && theta == o.theta && fmmOrder == o.fmmOrder && pmGrid == o.pmGrid
+            && treepmSplit == o.treepmSplit && treeRefit == o.treeRefit
+            && treeQuadrupole == o.treeQuadrupole && treeGroupSize == o.treeGroupSize;
+    }
+    bool operator!=(const PhysicsSettings& o) const { return !(*this == o); }
+};
+
+// Fills bodies.ax/ay/az with whichever solver the settings ask for. Holds on to
+// the solvers' scratch state (tree nodes, pair buffers) between steps. With an
+// active list only those bodies are updated; everyone still acts as a source.
+class Gravity
+{
+public:
+    PhysicsSettings settings;
+
+    void computeAccel(BodySoA& bodies, ThreadPool& pool, const std::vector<int>* active = nullptr)
+    {
+        tree.refit = settings.treeRefit;
+        tree.quadrupole = settings.treeQuadrupole;
+        if (active && active->size() < bodies.size()) {
+            // the pairwise sum has no way to skip rows, so subsets go to the plain direct sum
+            if (settings.solver == SOLVER_BARNES_HUT)
+                computeBarnesHut(bodies, pool, active);
+            else if (settings.solver == SOLVER_FMM)
+                fmm.compute(bodies, settings.G, settings.theta, settings.fmmOrder, pool, active);
+            else if (settings.solver == SOLVER_PM)
+                computePM(bodies, pool, active);
+            else if (settings.solver == SOLVER_TREEPM)
+                computeTreePM(bodies, pool, active);
+            else if (settings.solver == SOLVER_LBVH)
+                computeAccelLbvh(lbvh, bodies, settings.G, settings.theta, pool, active);
+            else if (settings.solver == SOLVER_FALCON)
+                falcon.compute(bodies, settings.G, settings.theta, settings.fmmOrder, pool, active);
+            else
+                computeAccelDirect(bodies, settings.G, pool, *active);
+            return;
+        }
+
+        switch (settings.solver) {
+        case SOLVER_BARNES_HUT:
+            computeBarnesHut(bodies, pool, nullptr);
+            break;
+        case SOLVER_PM:
+            computePM(bodies, pool, nullptr);
+            break;
+        case SOLVER_TREEPM:
+            computeTreePM(bodies, pool, nullptr);
+            break;
+        case SOLVER_LBVH:
+            computeAccelLbvh(lbvh, bodies, settings.G, settings.theta, pool);
+            break;
+        case SOLVER_FMM:
+            fmm.compute(bodies, settings.G, settings.theta, settings.fmmOrder, pool);
+            break;
+        case SOLVER_FALCON:
+            falcon.compute(bodies, settings.G, settings.theta, settings.fmmOrder, pool);
+            break;
+        case SOLVER_DIRECT_PAIRWISE:
+            pairwise.compute(bodies, settings.G, pool);
+            break;
+        default:
+            computeAccelDirect(bodies, settings.G, pool);
+            break;
+        }
+    }
+
+    // Accelerations on massless tracers from the massive bodies: a direct sum
+    // under the direct solvers, otherwise Barnes-Hut walks of an octree over
+    // the massive bodies, grouped as treeGroupSize says. That tree is kept
+    // apart from the solver's, which may be holding some other set of bodies
+    // (Wisdom-Holman's satellites).
+    void computeTracerAccel(const BodySoA& massive, BodySoA& tracers, ThreadPool& pool)
+    {
+        if (settings.solver == SOLVER_DIRECT || settings.solver == SOLVER_DIRECT_PAIRWISE || massive.empty()) {
+            computeTracerAccelDirect(massive, tracers, settings.G, pool);
+            return;
+        }
+        tracerTree.refit = settings.treeRefit;
+        tracerTree.quadrupole = settings.treeQuadrupole;
+        tracerTree.update(massive, pool);
+        tracerWalk.groupSize = settings.treeGroupSize;
+        computeTracerAccelTree(tracerTree, massive, tracers, settings.G, settings.theta, tracerWalk, pool);
+    }
+
+    const FmmTimings& fmmTimings() const { return fmm.timings; }
+    const FmmTimings& falconTimings() const { return falcon.timings; }
+    const LbvhTimings& lbvhTimings() const { return lbvh.timings; }
+    const TreeStats& treeStats() const { return tree.stats; }
+    const GroupWalkStats& groupWalkStats() const { return groupWalk.stats; }
+
+    // the bodies were reordered (slot i now holds what was in slot perm[i])
+    void reorder(const std::vector<int>& perm)
+    {
+        tree.reorder(perm);
+        tracerTree.reorder(perm);
+    }
+
+private:
+    Octree tree;
+    Octree tracerTree;
+    GroupWalk tracerWalk;
+    FastMultipole fmm;
+    Falcon falcon;
+    ParticleMesh pm;
+    TreePM treepm;
+    LinearBvh lbvh;
+    GroupWalk groupWalk;
+
+    void computeBarnesHut(BodySoA& bodies, ThreadPool& pool, const std::vector<int>* active)
+    {
+        if (settings.treeGroupSize <= 0) {
+            if (active)
+                computeAccelBarnesHut(tree, bodies, settings.G, settings.theta, pool, *active);
+            else
+                computeAccelBarnesHut(tree, bodies, settings.G, settings.theta, pool);
+            return;
+        }
+        tree.update(bodies, pool);
+        groupWalk.groupSize = settings.treeGroupSize;
+        groupWalk.compute(tree, bodies, settings.G, settings.theta, pool, active);
+    }
+
+    void computePM(BodySoA& bodies, ThreadPool& pool, const std::vector<int>* active)
+    {
+        pm.gridSize = settings.pmGrid;
+        pm.compute(bodies, settings.G, pool, active);
+    }
+
+    void computeTreePM(BodySoA& bodies, ThreadPool& pool, const std::vector<int>* active)
+    {
+        treepm.compute(bodies, settings.G, settings.theta, settings.pmGrid, settings.treepmSplit, pool, active);
+    }
+    SymmetricDirectSum pairwise;
+};
+
+#endif
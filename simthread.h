@@ -0,0 +1,183 @@
+#ifndef SIMTHREAD_H
+#define SIMTHREAD_H
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "barneshut.h"
+#include "directsum.h"
+#include "fmm.h"
+#include "falcon.h"
+#include "lbvh.h"
+#include "groupwalk.h"
+#include "simulation.h"
+#include "spscqueue.h"
+#include "triplebuffer.h"
+
+// results of on-demand checks, which run on the simulation thread
+struct SimDiagnostics {
+    ForceError forceError;
+    double energy = 0.0;
+    double energy0 = 0.0;
+};
+
+// what the render loop gets to see of the simulation
+struct SimSnapshot {
+    std::vector<glm::vec3> positions;
+    double time = 0.0;
+    long long steps = 0;
+    int lastSubsteps = 0;
+    float stepMs = 0.0f;
+    // block timestep statistics, empty for the other integrators
+    long long forceEvals = 0;
+    std::vector<int> levelCounts;
+    // Hermite steps in the last call and the length of the last one
+    int hermiteSteps = 0;
+    double hermiteStep = 0.0;
+    // patched conics: primary changes since the integrator was set up
+    long long soiTransitions = 0;
+    // phase timings of the last FMM evaluation
+    FmmTimings fmm;
+    // the same for the last falcON evaluation
+    FmmTimings falcon;
+    // phase timings of the last linear BVH build
+    LbvhTimings lbvh;
+    // Barnes-Hut octree upkeep and the last group walk
+    TreeStats tree;
+    GroupWalkStats groupWalk;
+    // cost of the last Morton reorder
+    float sortMs = 0.0f;
+    SimDiagnostics diagnostics;
+};
+
+// runs on the simulation thread between steps
+typedef std::function<void(Simulation&, SimDiagnostics&)> SimCommand;
+
+// Runs a Simulation on its own thread, paced against the wall clock. After
+// every batch of steps the positions are copied into a triple buffer, so the
+// render loop always has a complete state to draw without waiting on physics.
+// The UI changes settings by sending commands through a lock-free queue; they
+// are applied between steps, never in the middle of one.
+class SimulationThread
+{
+public:
+    SimulationThread(BodySoA initial, ThreadPool& pool) : sim(std::move(initial), pool) {}
+    ~SimulationThread() { stop(); }
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // only safe to touch before start()
+    Simulation& simulation() { return sim; }
+
+    void start()
+    {
+        publish(0.0f);
+        quitting.store(false, std::memory_order_relaxed);
+        thread = std::thread(&SimulationThread::run, this);
+    }
+
+    void stop()
+    {
+        quitting.store(true, std::memory_order_release);
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // false if the queue is full; the command is dropped
+    bool send(SimCommand command) { return commands.push(std::move(command)); }
+
+    // render side: picks up the newest snapshot, if there is one
+    bool update() { return snapshots.update(); }
+    const SimSnapshot& latest() const { return snapshots.front(); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Simulation sim;
+    SimDiagnostics diagnostics;
+    SpscQueue<SimCommand, 256> commands;
+    TripleBuffer<SimSnapshot> snapshots;
+    std::thread thread;
+    std::atomic<bool> quitting{ false };
+
+    void run()
+    {
+        Clock::time_point last = Clock::now();
+        float stepMs = 0.0f;
+        while (!quitting.load(std::memory_order_acquire)) {
+            bool changed = false;
+            SimCommand command;
+            while (commands.pop(command)) {
+                command(sim, diagnostics);
+                changed = true;
+            }
+
+            Clock::time_point now = Clock::now();
+            double frameTime = std::chrono::duration<double>(now - last).count();
+            last = now;
+            int n = sim.advance(frameTime);
+            if (n > 0) {
+                stepMs = 1000.0f * std::chrono::duration<float>(Clock::now() - now).count() / n;
+                changed = true;
+            }
+            if (changed)
+                publish(stepMs);
+
+            // nap until the next step is due, in short slices so commands and
+            // stop() are still picked up promptly
+            double wait = std::min(sim.timeToNextStep(), 0.002);
+            if (n == 0 && wait > 0.0)
+                std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        }
+    }
+
+    void publish(float stepMs)
+    {
+        SimSnapshot& snap = snapshots.back();
+        const BodySoA& bodies = sim.bodies;
+        // by id, so every body keeps its instance slot (and colour) however
+        // the arrays have been reordered; tracers come after the massive bodies
+        const BodySoA& tracers = sim.tracers;
+        snap.positions.resize(bodies.size() + tracers.size());
+        for (size_t i = 0; i < bodies.size(); i++)
+            snap.positions[bodies.id[i]] = glm::vec3(bodies.x[i], bodies.y[i], bodies.z[i]);
+        for (size_t i = 0; i < tracers.size(); i++)
+            snap.positions[bodies.size() + tracers.id[i]] = glm::vec3(tracers.x[i], tracers.y[i], tracers.z[i]);
+        snap.time = sim.time;
+        snap.steps = sim.steps;
+        snap.lastSubsteps = sim.lastSubsteps;
+        snap.stepMs = stepMs;
+        snap.forceEvals = 0;
+        snap.levelCounts.clear();
+        if (BlockTimestepLeapfrog* block = dynamic_cast<BlockTimestepLeapfrog*>(sim.integratorImpl())) {
+            snap.forceEvals = block->lastForceEvals;
+            snap.levelCounts = block->levelCounts;
+        }
+        snap.hermiteSteps = 0;
+        snap.hermiteStep = 0.0;
+        if (HermiteIntegrator* hermite = dynamic_cast<HermiteIntegrator*>(sim.integratorImpl())) {
+            snap.forceEvals = hermite->lastForceEvals;
+            snap.hermiteSteps = hermite->lastSubsteps;
+            snap.hermiteStep = hermite->lastStep;
+        }
+        snap.soiTransitions = 0;
+        if (PatchedConics* conics = dynamic_cast<PatchedConics*>(sim.integratorImpl()))
+            snap.soiTransitions = conics->totalTransitions;
+        snap.fmm = sim.gravity.fmmTimings();
+        snap.falcon = sim.gravity.falconTimings();
+        snap.lbvh = sim.gravity.lbvhTimings();
+        snap.tree = sim.gravity.treeStats();
+        snap.groupWalk = sim.gravity.groupWalkStats();
+        snap.sortMs = sim.sorter.lastMs;
+        snap.diagnostics = diagnostics;
+        snapshots.publish();
+    }
+};
+
+#endif
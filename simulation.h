@@ -0,0 +1,179 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <algorithm>
+#include <memory>
+#include "body.h"
+#include "threadpool.h"
+#include "physics.h"
+#include "integrator.h"
+#include "blocktimestep.h"
+#include "hermite.h"
+#include "wisdomholman.h"
+#include "keplerpropagator.h"
+#include "patchedconics.h"
+#include "morton.h"
+#include "tracers.h"
+
+enum IntegratorType {
+    INTEGRATOR_LEAPFROG,
+    INTEGRATOR_EULER,
+    INTEGRATOR_BLOCK,
+    INTEGRATOR_HERMITE,
+    INTEGRATOR_WISDOM_HOLMAN,
+    INTEGRATOR_KEPLER,
+    INTEGRATOR_PATCHED_CONICS
+};
+const char* const integratorNames[] = { "Leapfrog (KDK)", "Semi-implicit Euler", "Block timesteps (KDK)", "Hermite (4th order)",
+    "Wisdom-Holman (DH)", "Kepler orbits (analytic)", "Patched conics (SOI)" };
+
+inline std::unique_ptr<Integrator> makeIntegrator(int type)
+{
+    switch (type) {
+    case INTEGRATOR_EULER: return std::unique_ptr<Integrator>(new SemiImplicitEuler());
+    case INTEGRATOR_BLOCK: return std::unique_ptr<Integrator>(new BlockTimestepLeapfrog());
+    case INTEGRATOR_HERMITE: return std::unique_ptr<Integrator>(new HermiteIntegrator());
+    case INTEGRATOR_WISDOM_HOLMAN: return std::unique_ptr<Integrator>(new WisdomHolman());
+    case INTEGRATOR_KEPLER: return std::unique_ptr<Integrator>(new KeplerPropagator());
+    case INTEGRATOR_PATCHED_CONICS: return std::unique_ptr<Integrator>(new PatchedConics());
+    default: return std::unique_ptr<Integrator>(new LeapfrogKDK());
+    }
+}
+
+// Owns the bodies and steps them with a fixed dt, independent of how long
+// frames take. advance() banks the frame time and runs as many whole steps as
+// it covers; a frame that would need more than maxSubsteps drops the excess, so
+// a slow machine runs the simulation slower than real time rather than falling
+// further behind every frame.
+class Simulation
+{
+public:
+    BodySoA bodies;
+    // zero-mass bodies, split off at construction: they feel the massive
+    // bodies and nothing else
+    BodySoA tracers;
+    Gravity gravity;
+    float dt = 1.0f / 60.0f;
+    int maxSubsteps = 8;
+
+    double time = 0.0;
+    long long steps = 0;
+    int lastSubsteps = 0;
+    // accelerations evaluated so far, summed over every force call
+    long long targetEvals = 0;
+    // the same for tracers, each against the massive bodies only
+    long long tracerEvals = 0;
+    // reorder the bodies along a Morton curve every this many steps; 0 never does
+    int sortInterval = 16;
+    MortonSorter sorter;
+    MortonSorter tracerSorter;
+
+    Simulation(BodySoA initial, ThreadPool& pool) : bodies(std::move(initial)), workers(pool)
+    {
+        tracers = splitTracers(bodies);
+        // the tracer group walk takes tracers in runs as stored, so they need
+        // to be in Morton order even if the bodies never get sorted
+        if (!tracers.empty())
+            tracerSorter.sort(tracers, workers);
+        setIntegrator(INTEGRATOR_LEAPFROG);
+    }
+
+    void setIntegrator(int type)
+    {
+        integratorType = type;
+        integrator = makeIntegrator(type);
+    }
+    int getIntegrator() const { return integratorType; }
+    Integrator* integratorImpl() { return integrator.get(); }
+    ThreadPool& pool() { return workers; }
+
+    void step()
+    {
+        if (gravity.settings != lastSettings) {
+            integrator->reset();
+            tracersPrimed = false;
+            lastSettings = gravity.settings;
+        }
+        if (sortInterval > 0 && steps % sortInterval == 0) {
+            sorter.sort(bodies, workers);
+            integrator->reorder(sorter.order());
+            gravity.reorder(sorter.order());
+            if (!tracers.empty())
+                tracerSorter.sort(tracers, workers);
+        }
+        // Integrators built on a Kepler map (Wisdom-Holman, analytic Kepler,
+        // patched conics) move the tracers through the same map, so steps
+        // that are a good part of an orbit are as safe for them as for the
+        // massive bodies. Under the others the tracers take a kick-drift-kick
+        // step in the massive bodies' field at either end of the step, with
+        // the same limit on dt as leapfrog: it has to stay well under the
+        // innermost tracer orbit's period. The first half needs only the
+        // start of the step, so it goes first.
+        const bool mapped = integrator->movesTracers() && !bodies.empty();
+        const bool leapfrogTracers = !tracers.empty() && !mapped;
+        if (leapfrogTracers) {
+            if (!tracersPrimed)
+                tracerAccel();
+            kick(tracers, 0.5f * dt, workers);
+            drift(tracers, dt, workers);
+        }
+        integrator->G = gravity.settings.G;
+        integrator->tracers = mapped && !tracers.empty() ? &tracers : nullptr;
+        integrator->tracerAccel = [this](const BodySoA& sources, BodySoA& t) {
+            gravity.computeTracerAccel(sources, t, workers);
+            tracerEvals += (long long)t.size();
+        };
+        integrator->step(bodies, dt, [this](BodySoA& b, const std::vector<int>* active) {
+            gravity.computeAccel(b, workers, active);
+            targetEvals += active ? (long long)active->size() : (long long)b.size();
+        }, workers);
+        // Hermite brings its own direct sum (it needs jerks as well)
+        if (HermiteIntegrator* hermite = dynamic_cast<HermiteIntegrator*>(integrator.get()))
+            targetEvals += hermite->lastForceEvals;
+        if (leapfrogTracers) {
+            tracerAccel();
+            kick(tracers, 0.5f * dt, workers);
+        }
+        else {
+            // the map's integrator leaves its own accelerations in them
+            tracersPrimed = false;
+        }
+        time += dt;
+        steps++;
+    }
+
+    int advance(double frameTime)
+    {
+        accumulator += frameTime;
+        int n = 0;
+        while (accumulator >= dt && n < maxSubsteps) {
+            step();
+            accumulator -= dt;
+            n++;
+        }
+        if (accumulator >= dt)
+            accumulator = 0.0;
+        lastSubsteps = n;
+        return n;
+    }
+
+    // wall time until advance() would run another step
+    double timeToNextStep() const { return std::max(0.0, dt - accumulator); }
+
+private:
+    ThreadPool& workers;
+    std::unique_ptr<Integrator> integrator;
+    int integratorType = INTEGRATOR_LEAPFROG;
+    PhysicsSettings lastSettings;
+    double accumulator = 0.0;
+    bool tracersPrimed = false;
+
+    void tracerAccel()
+    {
+        gravity.computeTracerAccel(bodies, tracers, workers);
+        tracerEvals += (long long)tracers.size();
+        tracersPrimed = true;
+    }
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded single-producer, single-consumer ring. push() and pop() never block;
+// push() returns false when the ring is full and pop() when it is empty. One
+// slot is kept free to tell full from empty. The two indices sit on separate
+// cache lines so producer and consumer don't false-share.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+    bool push(T value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t next = (h + 1) % Capacity;
+        if (next == tail.load(std::memory_order_acquire))
+            return false;
+        slots[h] = std::move(value);
+        head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+        out = std::move(slots[t]);
+        slots[t] = T();
+        tail.store((t + 1) % Capacity, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T slots[Capacity];
+    std::atomic<size_t> head{ 0 };
+    char pad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail{ 0 };
+};
+
+#endif
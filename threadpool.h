@@ -0,0 +1,193 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads for data-parallel loops. Threads are made
+// once at startup and sleep between jobs, so a frame never pays for thread
+// creation. parallelFor cuts [0, n) into chunks and deals each worker an equal
+// contiguous run of them; a worker that runs dry steals chunks from the back of
+// another worker's run, which evens out loops whose iterations cost different
+// amounts (tree walks, triangular pair loops). The calling thread joins in as
+// worker 0.
+class ThreadPool
+{
+public:
+    // fn(begin, end, worker) with worker in [0, size())
+    typedef std::function<void(size_t, size_t, int)> RangeFn;
+
+    explicit ThreadPool(int threads = 0)
+    {
+        if (threads <= 0)
+            threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        queues.reset(new Queue[threads]);
+        for (int t = 1; t < threads; t++)
+            workers.emplace_back(&ThreadPool::workerLoop, this, t);
+        numThreads = threads;
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return numThreads; }
+
+    void parallelFor(size_t n, size_t grain, const RangeFn& fn)
+    {
+        if (n == 0)
+            return;
+        if (grain == 0)
+            grain = 1;
+        const size_t chunks = (n + grain - 1) / grain;
+        // nested calls and single chunks just run inline
+        if (numThreads == 1 || chunks == 1 || insideWorker()) {
+            fn(0, n, insideWorker() ? currentWorker() : 0);
+            return;
+        }
+
+        std::unique_lock<std::mutex> callLock(callMutex);
+        job.fn = &fn;
+        job.n = n;
+        job.grain = grain;
+        // a worker still on its way out of the previous job may grab one of
+        // these chunks as soon as a queue is published, so the job and the
+        // chunk count have to be in place first
+        remaining.store(chunks, std::memory_order_relaxed);
+        for (int t = 0; t < numThreads; t++) {
+            uint32_t lo = (uint32_t)(chunks * t / numThreads);
+            uint32_t hi = (uint32_t)(chunks * (t + 1) / numThreads);
+            queues[t].range.store(pack(lo, hi), std::memory_order_release);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+        }
+        wake.notify_all();
+
+        runChunks(0);
+        while (remaining.load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+        job.fn = nullptr;
+    }
+
+private:
+    // a worker's remaining chunk run [lo, hi), packed so owner and thieves can
+    // both update it with a single compare-exchange; padded to a cache line so
+    // neighbouring queues don't false-share
+    struct Queue {
+        std::atomic<uint64_t> range{ 0 };
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    struct Job {
+        const RangeFn* fn = nullptr;
+        size_t n = 0;
+        size_t grain = 1;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<Queue[]> queues;
+    int numThreads = 1;
+    Job job;
+    std::atomic<size_t> remaining{ 0 };
+
+    std::mutex callMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    uint64_t generation = 0;
+    bool quitting = false;
+
+    static uint64_t pack(uint32_t lo, uint32_t hi) { return ((uint64_t)hi << 32) | lo; }
+    static uint32_t lo(uint64_t r) { return (uint32_t)r; }
+    static uint32_t hi(uint64_t r) { return (uint32_t)(r >> 32); }
+
+    static int& workerSlot()
+    {
+        static thread_local int slot = -1;
+        return slot;
+    }
+    static bool insideWorker() { return workerSlot() >= 0; }
+    static int currentWorker() { return workerSlot(); }
+
+    bool popFront(int t, uint32_t& chunk)
+    {
+        uint64_t r = queues[t].range.load(std::memory_order_acquire);
+        while (lo(r) < hi(r)) {
+            if (queues[t].range.compare_exchange_weak(r, pack(lo(r) + 1, hi(r)), std::memory_order_acq_rel)) {
+                chunk = lo(r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool stealBack(int t, uint32_t& chunk)
+    {
+        uint64_t r = queues[t].range.load(std::memory_order_acquire);
+        while (lo(r) < hi(r)) {
+            if (queues[t].range.compare_exchange_weak(r, pack(lo(r), hi(r) - 1), std::memory_order_acq_rel)) {
+                chunk = hi(r) - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runChunk(uint32_t chunk, int worker)
+    {
+        size_t b = (size_t)chunk * job.grain;
+        size_t e = std::min(job.n, b + job.grain);
+        (*job.fn)(b, e, worker);
+        remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    void runChunks(int self)
+    {
+        workerSlot() = self;
+        uint32_t chunk;
+        while (popFront(self, chunk))
+            runChunk(chunk, self);
+        // own run is empty: go round the others and steal from their tails
+        for (int k = 1; k < numThreads; k++) {
+            int victim = (self + k) % numThreads;
+            while (stealBack(victim, chunk))
+                runChunk(chunk, self);
+        }
+        workerSlot() = -1;
+    }
+
+    void workerLoop(int self)
+    {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quitting || generation != seen; });
+                if (quitting)
+                    return;
+                seen = generation;
+            }
+            runChunks(self);
+        }
+    }
+};
+
+#endif
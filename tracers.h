@@ -0,0 +1,88 @@
+#ifndef TRACERS_H
+#define TRACERS_H
+
+#include <vector>
+#include "body.h"
+#include "forcekernel.h"
+#include "threadpool.h"
+#include "directsum.h"
+#include "barneshut.h"
+#include "groupwalk.h"
+#include "kepler.h"
+
+// Massless tracers: bodies with zero mass feel the massive bodies but pull on
+// nothing, so they are kept in a BodySoA of their own and never appear as
+// sources. Forces on them cost O(N_massive x N_tracers), or a tree walk each,
+// instead of adding to the massive bodies' O(N^2).
+
+// Moves every zero-mass body out of bodies and returns them. ids are
+// renumbered in both sets, keeping their order: the massive bodies get
+// 0 .. M - 1 and the tracers 0 .. T - 1.
+inline BodySoA splitTracers(BodySoA& bodies)
+{
+    BodySoA massive, tracers;
+    for (size_t i = 0; i < bodies.size(); i++) {
+        BodySoA& to = bodies.mass[i] == 0.0f ? tracers : massive;
+        to.push_back(bodies.get(i));
+    }
+    bodies = std::move(massive);
+    return tracers;
+}
+
+// accelerations on every tracer from every source, streaming the sources past
+// blocks of tracers with the kernel picked at startup
+inline void computeTracerAccelDirect(const BodySoA& sources, BodySoA& tracers, float G, ThreadPool& pool)
+{
+    tracers.zeroAcc();
+    if (sources.empty())
+        return;
+    const AccelKernel kernel = activeAccelKernel();
+    pool.parallelFor(tracers.size(), 64, [&](size_t b, size_t e, int) {
+        kernel(&tracers.x[b], &tracers.y[b], &tracers.z[b], e - b,
+               sources.x.data(), sources.y.data(), sources.z.data(), sources.mass.data(), sources.size(),
+               G, SOFTENING, &tracers.ax[b], &tracers.ay[b], &tracers.az[b]);
+    });
+}
+
+// the same through Barnes-Hut walks of an octree over the sources, which has
+// to be up to date for their current positions: one per run of tracers if
+// walk.groupSize > 0, else one per tracer
+inline void computeTracerAccelTree(const Octree& tree, const BodySoA& sources, BodySoA& tracers, float G, float theta,
+                                   GroupWalk& walk, ThreadPool& pool)
+{
+    if (walk.groupSize > 0 && !tree.hasQuadrupoles()) {
+        walk.computeAt(tree, sources, tracers, G, theta, pool);
+        return;
+    }
+    pool.parallelFor(tracers.size(), 256, [&](size_t b, size_t e, int) {
+        for (size_t k = b; k < e; k++) {
+            const glm::vec3 a = tree.accelAt(sources, tracers.pos(k), -1, G, theta);
+            tracers.ax[k] = a.x;
+            tracers.ay[k] = a.y;
+            tracers.az[k] = a.z;
+        }
+    });
+}
+
+// Drifts the tracers dt along Kepler orbits about a central body of G M = mu
+// that goes from c0, v0 to c1, v1 over the step: they are taken relative to
+// it, drifted in double and put back relative to where it ended up. Returns
+// how many the solver couldn't handle and moved in a straight line.
+inline int keplerDriftTracers(BodySoA& tracers, double mu, double dt, const glm::dvec3& c0, const glm::dvec3& v0,
+                              const glm::dvec3& c1, const glm::dvec3& v1, ThreadPool& pool)
+{
+    const size_t n = tracers.size();
+    std::vector<double> x(n), y(n), z(n), vx(n), vy(n), vz(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = tracers.x[i] - c0.x; y[i] = tracers.y[i] - c0.y; z[i] = tracers.z[i] - c0.z;
+        vx[i] = tracers.vx[i] - v0.x; vy[i] = tracers.vy[i] - v0.y; vz[i] = tracers.vz[i] - v0.z;
+    }
+    const int failures = keplerDriftParallel(mu, dt, n, x.data(), y.data(), z.data(), vx.data(), vy.data(), vz.data(), pool);
+    for (size_t i = 0; i < n; i++) {
+        tracers.x[i] = (float)(c1.x + x[i]); tracers.y[i] = (float)(c1.y + y[i]); tracers.z[i] = (float)(c1.z + z[i]);
+        tracers.vx[i] = (float)(v1.x + vx[i]); tracers.vy[i] = (float)(v1.y + vy[i]); tracers.vz[i] = (float)(v1.z + vz[i]);
+    }
+    return failures;
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef TREEPM_H
+#define TREEPM_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "directsum.h"
+#include "barneshut.h"
+#include "particlemesh.h"
+
+// TreePM: gravity split at a scale r_s into a smooth long-range part, solved on
+// the particle mesh, and a short-range remainder summed with a tree walk.
+// 1/r = erf(r / 2r_s) / r + erfc(r / 2r_s) / r; the erfc part is negligible
+// beyond cutoff * r_s, so the walk skips every cell further away than that and
+// only ever looks at a body's neighbourhood. r_s is set in mesh cells, and is
+// converted using the mesh size, which follows the bounding box.
+class TreePM
+{
+public:
+    float cutoff = 4.5f;   // short-range cut-off, in units of r_s
+
+    void compute(BodySoA& bodies, float G, float theta, int grid, float splitCells, ThreadPool& pool,
+                 const std::vector<int>* active = nullptr)
+    {
+        if (bodies.empty())
+            return;
+        splitCells = std::max(splitCells, 0.25f);
+        mesh.gridSize = grid;
+        mesh.splitCells = splitCells;
+        mesh.compute(bodies, G, pool, active);
+
+        rs = splitCells * mesh.cellSize();
+        buildTable();
+        tree.build(bodies);
+        auto walk = [&](int i) {
+            glm::vec3 a = shortRangeAccelOn(bodies, i, G, theta);
+            bodies.ax[i] += a.x;
+            bodies.ay[i] += a.y;
+            bodies.az[i] += a.z;
+        };
+        if (active) {
+            pool.parallelFor(active->size(), 256, [&](size_t b, size_t e, int) {
+                for (size_t k = b; k < e; k++)
+                    walk((*active)[k]);
+            });
+        }
+        else {
+            pool.parallelFor(bodies.size(), 256, [&](size_t b, size_t e, int) {
+                for (size_t k = b; k < e; k++)
+                    walk(tree.order[k]);
+            });
+        }
+    }
+
+    // split scale of the last evaluation, in world units
+    float splitRadius() const { return rs; }
+
+private:
+    static const int TABLE_SIZE = 1024;
+    ParticleMesh mesh;
+    Octree tree;
+    float rs = 1.0f;
+    // short-range force factor erfc(u/2) + u/sqrt(pi) exp(-u^2/4), u = r / r_s
+    std::vector<float> table;
+    float tableFor = -1.0f;
+
+    void buildTable()
+    {
+        if (tableFor == cutoff)
+            return;
+        tableFor = cutoff;
+        table.resize(TABLE_SIZE + 2);
+        const double pi = 3.14159265358979323846;
+        for (int k = 0; k <= TABLE_SIZE + 1; k++) {
+            double u = (double)cutoff * k / TABLE_SIZE;
+            table[k] = (float)(std::erfc(0.5 * u) + u / std::sqrt(pi) * std::exp(-0.25 * u * u));
+        }
+    }
+
+    // softened pair pull scaled by the short-range factor, zero past the cut-off
+    glm::vec3 shortPair(const glm::vec3& p, const glm::vec3& q, float mj, float G) const
+    {
+        glm::vec3 dir = q - p;
+        float d2 = glm::dot(dir, dir);
+        float u = std::sqrt(d2) / rs;
+        if (u >= cutoff)
+            return glm::vec3(0.0f);
+        float t = u * (TABLE_SIZE / cutoff);
+        int k = (int)t;
+        float f = t - (float)k;
+        float factor = table[k] + f * (table[k + 1] - table[k]);
+        float r2 = d2 + SOFTENING;
+        return (G * mj * factor / (r2 * std::sqrt(r2))) * dir;
+    }
+
+    // Barnes-Hut walk of the erfc part: cells entirely beyond the cut-off are
+    // dropped, the rest are opened with the usual opening angle
+    glm::vec3 shortRangeAccelOn(const BodySoA& bodies, int i, float G, float theta) const
+    {
+        glm::vec3 acc(0.0f);
+        const glm::vec3 p = bodies.pos(i);
+        const float rcut = cutoff * rs;
+        const float rcut2 = rcut * rcut;
+        const float theta2 = theta * theta;
+
+        int stack[8 * 64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const OctreeNode& node = tree.nodes[stack[--top]];
+            if (node.count == 0)
+                continue;
+            glm::vec3 gap = glm::max(glm::abs(p - node.center) - glm::vec3(node.halfSize), glm::vec3(0.0f));
+            if (glm::dot(gap, gap) >= rcut2)
+                continue;
+
+            if (node.firstChild < 0) {
+                for (int k = node.begin; k < node.begin + node.count; k++) {
+                    int j = tree.order[k];
+                    if (j == i) continue;
+                    acc += shortPair(p, bodies.pos(j), bodies.mass[j], G);
+                }
+                continue;
+            }
+
+            glm::vec3 dir = node.com - p;
+            float dist2 = glm::dot(dir, dir);
+            float size = 2.0f * node.halfSize;
+            bool inside = glm::all(glm::lessThanEqual(glm::abs(p - node.center), glm::vec3(node.halfSize)));
+            if (size * size < theta2 * dist2 && !inside) {
+                acc += shortPair(p, node.com, node.mass, G);
+            }
+            else {
+                for (int c = 7; c >= 0; c--)
+                    stack[top++] = node.firstChild + c;
+            }
+        }
+        return acc;
+    }
+};
+
+// TreePM accelerations for everyone, checked body for body against the direct sum
+inline ForceError measureTreePMError(const BodySoA& bodies, float G, float theta, int grid, float splitCells,
+                                     ThreadPool& pool, int maxSamples = 1000)
+{
+    BodySoA copy = bodies;
+    TreePM treepm;
+    treepm.compute(copy, G, theta, grid, splitCells, pool);
+    return measureForceErrorOf(bodies, G, [&](int i) { return copy.acc(i); }, maxSamples);
+}
+
+#endif
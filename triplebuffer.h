@@ -0,0 +1,46 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Single-producer, single-consumer triple buffer. The writer fills its back
+// slot and publishes it by swapping it with the middle one; the reader swaps
+// the middle slot into the front when there is something new. Neither side
+// ever waits for the other: the writer can publish as often as it likes (older
+// unread states are simply overwritten) and the reader keeps the last state it
+// picked up until a newer one arrives.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // writer side
+    T& back() { return slots[backIndex]; }
+    void publish()
+    {
+        uint8_t prev = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+        backIndex = prev & INDEX;
+    }
+
+    // reader side: true if a newer state was picked up
+    bool update()
+    {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+            return false;
+        uint8_t prev = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = prev & INDEX;
+        return true;
+    }
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static const uint8_t INDEX = 3;
+    static const uint8_t FRESH = 4;
+
+    T slots[3];
+    uint8_t backIndex = 0;
+    uint8_t frontIndex = 1;
+    std::atomic<uint8_t> middle{ 2 };
+};
+
+#endif
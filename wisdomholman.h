@@ -0,0 +1,330 @@
+#ifndef WISDOMHOLMAN_H
+#define WISDOMHOLMAN_H
+
+#include <algorithm>
+#include <vector>
+#include "body.h"
+#include "threadpool.h"
+#include "integrator.h"
+#include "kepler.h"
+
+// Wisdom-Holman mapping in democratic heliocentric coordinates (Duncan, Levison
+// & Lee 1998) for systems ruled by one heavy body. Satellites are tracked by
+// their position Q relative to the central body and their velocity u relative
+// to the centre of mass. The Hamiltonian then splits into a Kepler orbit about
+// the central mass for each satellite, a "jump" that moves every Q by the
+// central body's recoil (sum m u) / m0, and the satellites' pull on each
+// other. A step is
+//   kick h/2, jump h/2, Kepler drift h, jump h/2, kick h/2,
+// where the drift is exact (universal variables, see kepler.h) and only the
+// small satellite-satellite forces are integrated. Errors scale with the
+// satellites' mass relative to the central body instead of with the step, so
+// steps can be a sizeable fraction of the innermost orbit rather than a tiny
+// slice of it. The central body is the most massive one.
+//
+// Satellite-satellite forces come from the simulation's solver, run on a
+// scratch set of satellites placed at Q: the forces don't care where the origin
+// is. As with leapfrog, the forces a step ends with are the ones the next one
+// starts with, so it costs one force evaluation (of N - 1 bodies) per step.
+// The state is kept in double and written back to the float arrays after
+// every step; the bodies' accelerations are left alone. The drifts go through
+// the batched Kepler solver, a SIMD register of satellites at a time.
+//
+// Massless tracers take the same map: a Kepler drift about the central body,
+// the same jumps, and kicks from the satellites (through the simulation's
+// tracer solver, with the satellites at Q as sources). Their heliocentric
+// kick accelerations are kept in their ax/ay/az from one step to the next.
+class WisdomHolman : public Integrator
+{
+public:
+    bool movesTracers() const override { return true; }
+
+    // drifts in the last call that Kepler's equation couldn't be solved for
+    // (a satellite on top of the central body) and were done in a straight line
+    int lastKeplerFailures = 0;
+
+    void step(BodySoA& bodies, float dt, const AccelFn& accel, ThreadPool& pool) override
+    {
+        if (bodies.size() == 0)
+            return;
+        if (!primed || !inSync(bodies))
+            prime(bodies);
+        const double h = dt;
+        const bool withTracers = tracers && !tracers->empty();
+        if (withTracers)
+            importTracers();
+        if (!haveForces)
+            satelliteForces(accel);
+        if (withTracers && tracerForcesFor != tracers->size())
+            tracerForces();
+        kickSatellites(0.5 * h, pool);
+        jump(0.5 * h);
+        keplerDrift(h, pool);
+        jump(0.5 * h);
+        satelliteForces(accel);
+        if (withTracers)
+            tracerForces();
+        kickSatellites(0.5 * h, pool);
+        writeBack(bodies);
+        if (withTracers)
+            exportTracers();
+    }
+
+    void reset() override { primed = false; }
+
+    void reorder(const std::vector<int>& perm) override
+    {
+        if (!primed || m.size() != perm.size())
+            return;
+        for (std::vector<double>* v : { &m, &x, &y, &z, &vx, &vy, &vz }) {
+            std::vector<double> out(v->size());
+            for (size_t i = 0; i < perm.size(); i++)
+                out[i] = (*v)[perm[i]];
+            v->swap(out);
+        }
+        // the satellite arrays stay as they are and only their slots move
+        std::vector<int> slot(perm.size());
+        for (size_t i = 0; i < perm.size(); i++)
+            slot[perm[i]] = (int)i;
+        central = slot[central];
+        for (int& i : satellites)
+            i = slot[i];
+    }
+
+private:
+    bool primed = false;
+    bool haveForces = false;
+    // tracer count the tracers' kick accelerations are for, -1 if there are none
+    size_t tracerForcesFor = (size_t)-1;
+    int central = 0;
+    double comX = 0.0, comY = 0.0, comZ = 0.0, comVx = 0.0, comVy = 0.0, comVz = 0.0;
+    // satellite k sits in body slot satellites[k]; its heliocentric position,
+    // barycentric velocity, satellite-satellite acceleration and mass are
+    // stored contiguously so the Kepler drift can take them in SIMD batches
+    std::vector<int> satellites;
+    std::vector<double> qx, qy, qz, ux, uy, uz, fx, fy, fz, sm;
+    // the inertial state last written to the bodies, by slot
+    std::vector<double> x, y, z, vx, vy, vz, m;
+    BodySoA scratch;
+    // tracers' heliocentric positions and barycentric velocities, for the
+    // length of a step
+    std::vector<double> tqx, tqy, tqz, tux, tuy, tuz;
+
+    void satelliteForces(const AccelFn& accel)
+    {
+        const size_t ns = satellites.size();
+        // the tracers' kicks use these positions even when there's no
+        // satellite-satellite force to work out
+        for (size_t k = 0; k < ns; k++) {
+            scratch.x[k] = (float)qx[k];
+            scratch.y[k] = (float)qy[k];
+            scratch.z[k] = (float)qz[k];
+        }
+        if (ns < 2) {
+            std::fill(fx.begin(), fx.end(), 0.0);
+            std::fill(fy.begin(), fy.end(), 0.0);
+            std::fill(fz.begin(), fz.end(), 0.0);
+            haveForces = true;
+            return;
+        }
+        accel(scratch, nullptr);
+        for (size_t k = 0; k < ns; k++) {
+            fx[k] = scratch.ax[k];
+            fy[k] = scratch.ay[k];
+            fz[k] = scratch.az[k];
+        }
+        haveForces = true;
+    }
+
+    // pull of the satellites at Q on the tracers at theirs
+    void tracerForces()
+    {
+        for (size_t k = 0; k < tqx.size(); k++) {
+            tracers->x[k] = (float)tqx[k];
+            tracers->y[k] = (float)tqy[k];
+            tracers->z[k] = (float)tqz[k];
+        }
+        if (scratch.empty())
+            tracers->zeroAcc();
+        else
+            tracerAccel(scratch, *tracers);
+        tracerForcesFor = tracers->size();
+    }
+
+    void kickSatellites(double h, ThreadPool& pool)
+    {
+        pool.parallelFor(satellites.size(), 16384, [&](size_t b, size_t e, int) {
+            for (size_t k = b; k < e; k++) {
+                ux[k] += fx[k] * h;
+                uy[k] += fy[k] * h;
+                uz[k] += fz[k] * h;
+            }
+        });
+        if (tqx.empty())
+            return;
+        pool.parallelFor(tqx.size(), 16384, [&](size_t b, size_t e, int) {
+            for (size_t k = b; k < e; k++) {
+                tux[k] += tracers->ax[k] * h;
+                tuy[k] += tracers->ay[k] * h;
+                tuz[k] += tracers->az[k] * h;
+            }
+        });
+    }
+
+    // tracers to heliocentric positions and barycentric velocities, from
+    // their inertial ones and the central body's and centre of mass's state
+    // written back last step
+    void importTracers()
+    {
+        const size_t n = tracers->size();
+        for (std::vector<double>* v : { &tqx, &tqy, &tqz, &tux, &tuy, &tuz })
+            v->resize(n);
+        for (size_t k = 0; k < n; k++) {
+            tqx[k] = tracers->x[k] - x[central]; tqy[k] = tracers->y[k] - y[central]; tqz[k] = tracers->z[k] - z[central];
+            tux[k] = tracers->vx[k] - comVx; tuy[k] = tracers->vy[k] - comVy; tuz[k] = tracers->vz[k] - comVz;
+        }
+    }
+
+    void exportTracers()
+    {
+        for (size_t k = 0; k < tqx.size(); k++) {
+            tracers->x[k] = (float)(tqx[k] + x[central]);
+            tracers->y[k] = (float)(tqy[k] + y[central]);
+            tracers->z[k] = (float)(tqz[k] + z[central]);
+            tracers->vx[k] = (float)(tux[k] + comVx);
+            tracers->vy[k] = (float)(tuy[k] + comVy);
+            tracers->vz[k] = (float)(tuz[k] + comVz);
+        }
+        tqx.clear(); tqy.clear(); tqz.clear(); tux.clear(); tuy.clear(); tuz.clear();
+    }
+
+    // every satellite moves with the central body's recoil
+    void jump(double h)
+    {
+        const double m0 = m[central];
+        if (m0 <= 0.0)
+            return;
+        const size_t ns = satellites.size();
+        double px = 0.0, py = 0.0, pz = 0.0;
+        for (size_t k = 0; k < ns; k++) {
+            px += sm[k] * ux[k];
+            py += sm[k] * uy[k];
+            pz += sm[k] * uz[k];
+        }
+        const double sx = px / m0 * h, sy = py / m0 * h, sz = pz / m0 * h;
+        for (size_t k = 0; k < ns; k++) {
+            qx[k] += sx;
+            qy[k] += sy;
+            qz[k] += sz;
+        }
+        for (size_t k = 0; k < tqx.size(); k++) {
+            tqx[k] += sx;
+            tqy[k] += sy;
+            tqz[k] += sz;
+        }
+    }
+
+    void keplerDrift(double h, ThreadPool& pool)
+    {
+        const double mu = G * m[central];
+        lastKeplerFailures = keplerDriftParallel(mu, h, satellites.size(), qx.data(), qy.data(), qz.data(),
+                                                 ux.data(), uy.data(), uz.data(), pool);
+        lastKeplerFailures += keplerDriftParallel(mu, h, tqx.size(), tqx.data(), tqy.data(), tqz.data(),
+                                                  tux.data(), tuy.data(), tuz.data(), pool);
+        comX += comVx * h;
+        comY += comVy * h;
+        comZ += comVz * h;
+    }
+
+    // back to inertial positions and velocities
+    void writeBack(BodySoA& bodies)
+    {
+        const size_t ns = satellites.size();
+        double mass = 0.0, sx = 0.0, sy = 0.0, sz = 0.0, px = 0.0, py = 0.0, pz = 0.0;
+        for (size_t k = 0; k < ns; k++) {
+            sx += sm[k] * qx[k]; sy += sm[k] * qy[k]; sz += sm[k] * qz[k];
+            px += sm[k] * ux[k]; py += sm[k] * uy[k]; pz += sm[k] * uz[k];
+            mass += sm[k];
+        }
+        const double m0 = m[central];
+        mass += m0;
+        if (mass <= 0.0)
+            mass = 1.0;
+        const double cx = comX - sx / mass, cy = comY - sy / mass, cz = comZ - sz / mass;
+        x[central] = cx; y[central] = cy; z[central] = cz;
+        vx[central] = comVx; vy[central] = comVy; vz[central] = comVz;
+        if (m0 > 0.0) {
+            vx[central] -= px / m0; vy[central] -= py / m0; vz[central] -= pz / m0;
+        }
+        for (size_t k = 0; k < ns; k++) {
+            const int i = satellites[k];
+            x[i] = qx[k] + cx; y[i] = qy[k] + cy; z[i] = qz[k] + cz;
+            vx[i] = ux[k] + comVx; vy[i] = uy[k] + comVy; vz[i] = uz[k] + comVz;
+        }
+        for (size_t i = 0; i < m.size(); i++) {
+            bodies.x[i] = (float)x[i]; bodies.y[i] = (float)y[i]; bodies.z[i] = (float)z[i];
+            bodies.vx[i] = (float)vx[i]; bodies.vy[i] = (float)vy[i]; bodies.vz[i] = (float)vz[i];
+        }
+    }
+
+    bool inSync(const BodySoA& bodies) const
+    {
+        if (m.size() != bodies.size())
+            return false;
+        for (size_t i = 0; i < m.size(); i++) {
+            if ((float)x[i] != bodies.x[i] || (float)y[i] != bodies.y[i] || (float)z[i] != bodies.z[i]
+                || (float)vx[i] != bodies.vx[i] || (float)vy[i] != bodies.vy[i] || (float)vz[i] != bodies.vz[i]
+                || (float)m[i] != bodies.mass[i])
+                return false;
+        }
+        return true;
+    }
+
+    // takes over the bodies' state, with the heaviest body as the central one
+    void prime(const BodySoA& bodies)
+    {
+        const size_t n = bodies.size();
+        x.assign(bodies.x.begin(), bodies.x.end());
+        y.assign(bodies.y.begin(), bodies.y.end());
+        z.assign(bodies.z.begin(), bodies.z.end());
+        vx.assign(bodies.vx.begin(), bodies.vx.end());
+        vy.assign(bodies.vy.begin(), bodies.vy.end());
+        vz.assign(bodies.vz.begin(), bodies.vz.end());
+        m.assign(bodies.mass.begin(), bodies.mass.end());
+        central = (int)(std::max_element(m.begin(), m.end()) - m.begin());
+
+        double mass = 0.0;
+        comX = comY = comZ = comVx = comVy = comVz = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            comX += m[i] * x[i]; comY += m[i] * y[i]; comZ += m[i] * z[i];
+            comVx += m[i] * vx[i]; comVy += m[i] * vy[i]; comVz += m[i] * vz[i];
+            mass += m[i];
+        }
+        if (mass > 0.0) {
+            comX /= mass; comY /= mass; comZ /= mass;
+            comVx /= mass; comVy /= mass; comVz /= mass;
+        }
+
+        satellites.clear();
+        for (std::vector<double>* v : { &qx, &qy, &qz, &ux, &uy, &uz, &fx, &fy, &fz, &sm })
+            v->clear();
+        scratch = BodySoA();
+        for (int i = 0; i < (int)n; i++) {
+            if (i == central)
+                continue;
+            satellites.push_back(i);
+            qx.push_back(x[i] - x[central]); qy.push_back(y[i] - y[central]); qz.push_back(z[i] - z[central]);
+            ux.push_back(vx[i] - comVx); uy.push_back(vy[i] - comVy); uz.push_back(vz[i] - comVz);
+            sm.push_back(m[i]);
+            scratch.push_back({ glm::vec3(0.0f), glm::vec3(0.0f), bodies.mass[i], glm::vec3(0.0f) });
+        }
+        fx.assign(satellites.size(), 0.0);
+        fy.assign(satellites.size(), 0.0);
+        fz.assign(satellites.size(), 0.0);
+        haveForces = false;
+        tracerForcesFor = (size_t)-1;
+        primed = true;
+    }
+};
+
+#endif